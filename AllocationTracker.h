@@ -0,0 +1,245 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Counting is compiled in only when DAYW_TRACK_ALLOCATIONS is defined, which also replaces the global operator new and delete
+struct AllocationCounts
+{
+	unsigned long long allocations;
+	unsigned long long frees;
+	unsigned long long bytes;
+};
+
+class AllocationTracker
+{
+public:
+	// Tag 0 collects allocations outside any tagged scope
+	static const int TAG_COUNT = 32;
+	static const int UNTAGGED = 0;
+
+private:
+	// Each block remembers its size and allocating tag, so a free debits the tag that made it whichever scope frees it
+	struct BlockHeader
+	{
+		size_t size;
+		int tag;
+	};
+
+	static const size_t HEADER_SIZE = (sizeof(BlockHeader) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+	// Trivially constructible, so thread_local access from operator new needs no initialization guard
+	struct ThreadCounters
+	{
+		AllocationCounts total;
+		AllocationCounts tags[TAG_COUNT];
+		int tag;
+	};
+
+	static thread_local ThreadCounters counters;
+	static std::atomic<long long> liveBytes;
+	static std::atomic<long long> peakLiveBytes;
+	static std::atomic<long long> tagLiveBytes[TAG_COUNT];
+	static std::atomic<long long> tagPeakLiveBytes[TAG_COUNT];
+
+	static void count(AllocationCounts& counts, size_t size)
+	{
+		counts.allocations++;
+		counts.bytes += size;
+	}
+
+	static void raise(std::atomic<long long>& peak, long long live)
+	{
+		long long current = peak.load(std::memory_order_relaxed);
+
+		while (live > current && !peak.compare_exchange_weak(current, live, std::memory_order_relaxed))
+		{
+		}
+	}
+
+public:
+	static bool isCompiledIn()
+	{
+#ifdef DAYW_TRACK_ALLOCATIONS
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	static void* allocate(size_t size)
+	{
+		unsigned char* block = (unsigned char*)std::malloc(size + HEADER_SIZE);
+
+		if (!block)
+			return nullptr;
+
+		int tag = counters.tag;
+		BlockHeader* header = (BlockHeader*)block;
+		header->size = size;
+		header->tag = tag;
+
+		raise(peakLiveBytes, liveBytes.fetch_add((long long)size, std::memory_order_relaxed) + (long long)size);
+		raise(tagPeakLiveBytes[tag], tagLiveBytes[tag].fetch_add((long long)size, std::memory_order_relaxed) + (long long)size);
+
+		count(counters.total, size);
+		count(counters.tags[tag], size);
+
+		return block + HEADER_SIZE;
+	}
+
+	static void release(void* pointer)
+	{
+		if (!pointer)
+			return;
+
+		unsigned char* block = (unsigned char*)pointer - HEADER_SIZE;
+		BlockHeader* header = (BlockHeader*)block;
+
+		liveBytes.fetch_sub((long long)header->size, std::memory_order_relaxed);
+		tagLiveBytes[header->tag].fetch_sub((long long)header->size, std::memory_order_relaxed);
+		counters.total.frees++;
+		counters.tags[header->tag].frees++;
+
+		// Inlined into the replaced operator delete, GCC takes this for freeing memory from operator new; it came from malloc
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+		std::free(block);
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+	}
+
+	// Returns the previous tag so scopes can restore it
+	static int setTag(int tag)
+	{
+		int previous = counters.tag;
+		counters.tag = tag >= 0 && tag < TAG_COUNT ? tag : UNTAGGED;
+
+		return previous;
+	}
+
+	// Counters are per thread and describe the calling thread
+	static AllocationCounts getTotals() { return counters.total; }
+	static AllocationCounts getTagCounts(int tag) { return counters.tags[tag]; }
+
+	static void resetThread()
+	{
+		int tag = counters.tag;
+
+		counters = ThreadCounters();
+		counters.tag = tag;
+	}
+
+	static long long getLiveBytes() { return liveBytes.load(std::memory_order_relaxed); }
+	static long long getPeakLiveBytes() { return peakLiveBytes.load(std::memory_order_relaxed); }
+
+	static void resetPeak()
+	{
+		peakLiveBytes.store(liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+
+	// Process-wide bytes still held by blocks allocated under a tag, on any thread
+	static long long getTagLiveBytes(int tag) { return tagLiveBytes[tag].load(std::memory_order_relaxed); }
+	static long long getTagPeakLiveBytes(int tag) { return tagPeakLiveBytes[tag].load(std::memory_order_relaxed); }
+
+	static void resetTagPeaks()
+	{
+		for (int tag = 0; tag < TAG_COUNT; tag++)
+			tagPeakLiveBytes[tag].store(tagLiveBytes[tag].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+};
+
+// Per-tick allocation figures for the thread that runs the ticks
+class AllocationTickStats
+{
+	AllocationCounts start;
+
+public:
+	long long ticks;
+	long long zeroAllocationTicks;
+	unsigned long long allocations;
+	unsigned long long bytes;
+	unsigned long long maxAllocations;
+	unsigned long long lastAllocations;
+	long long maxPeakLiveBytes;
+
+	AllocationTickStats()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		start = AllocationCounts();
+		ticks = zeroAllocationTicks = 0;
+		allocations = bytes = maxAllocations = lastAllocations = 0;
+		maxPeakLiveBytes = 0;
+	}
+
+	void begin()
+	{
+		start = AllocationTracker::getTotals();
+		AllocationTracker::resetPeak();
+	}
+
+	void end()
+	{
+		AllocationCounts now = AllocationTracker::getTotals();
+
+		lastAllocations = now.allocations - start.allocations;
+		allocations += lastAllocations;
+		bytes += now.bytes - start.bytes;
+		ticks++;
+
+		if (lastAllocations == 0)
+			zeroAllocationTicks++;
+
+		if (lastAllocations > maxAllocations)
+			maxAllocations = lastAllocations;
+
+		if (AllocationTracker::getPeakLiveBytes() > maxPeakLiveBytes)
+			maxPeakLiveBytes = AllocationTracker::getPeakLiveBytes();
+	}
+};
+
+thread_local AllocationTracker::ThreadCounters AllocationTracker::counters;
+std::atomic<long long> AllocationTracker::liveBytes(0);
+std::atomic<long long> AllocationTracker::peakLiveBytes(0);
+std::atomic<long long> AllocationTracker::tagLiveBytes[AllocationTracker::TAG_COUNT];
+std::atomic<long long> AllocationTracker::tagPeakLiveBytes[AllocationTracker::TAG_COUNT];
+
+#ifdef DAYW_TRACK_ALLOCATIONS
+void* operator new(std::size_t size)
+{
+	void* pointer = AllocationTracker::allocate(size);
+
+	if (!pointer)
+		throw std::bad_alloc();
+
+	return pointer;
+}
+
+void* operator new[](std::size_t size)
+{
+	void* pointer = AllocationTracker::allocate(size);
+
+	if (!pointer)
+		throw std::bad_alloc();
+
+	return pointer;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return AllocationTracker::allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return AllocationTracker::allocate(size); }
+
+void operator delete(void* pointer) noexcept { AllocationTracker::release(pointer); }
+void operator delete[](void* pointer) noexcept { AllocationTracker::release(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { AllocationTracker::release(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { AllocationTracker::release(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { AllocationTracker::release(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { AllocationTracker::release(pointer); }
+#endif
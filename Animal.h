@@ -10,6 +10,8 @@ public:
 	{
 	}
 
+	virtual Entity* clone() { return new Animal(*this); }
+
 	virtual bool isReproducable()
 	{
 		return old >= 8 && old <= 30;
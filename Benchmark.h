@@ -0,0 +1,375 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <sstream>
+#include <memory>
+#include <cmath>
+#include "MathUtility.h"
+#include "SetUtility.h"
+#include "Model.h"
+#include "View.h"
+#include "Controller.h"
+
+struct BenchmarkResult
+{
+	std::string name;
+	int size;
+	double density;
+	int entities;
+
+	bool skipped;
+	double predictedSeconds;
+
+	long long iterations;
+	double meanNanoseconds;
+	double medianNanoseconds;
+	double minNanoseconds;
+
+	BenchmarkResult() : size(0), density(0), entities(0), skipped(false), predictedSeconds(0),
+		iterations(0), meanNanoseconds(0), medianNanoseconds(0), minNanoseconds(0) {}
+};
+
+// Relative weights of the kinds seeded into benchmark worlds, written as "planteating:predator:plant:food"
+struct PopulationMix
+{
+	int plantEating;
+	int predator;
+	int plant;
+	int food;
+
+	PopulationMix() : plantEating(50), predator(15), plant(20), food(15) {}
+
+	bool parse(const std::string& text)
+	{
+		char separator[3];
+		std::istringstream in(text);
+
+		return (bool)(in >> plantEating >> separator[0] >> predator >> separator[1] >> plant >> separator[2] >> food)
+			&& separator[0] == ':' && separator[1] == ':' && separator[2] == ':' && getTotal() > 0;
+	}
+
+	int getTotal() const { return plantEating + predator + plant + food; }
+
+	std::string toString() const
+	{
+		return std::to_string(plantEating) + ":" + std::to_string(predator) + ":" + std::to_string(plant) + ":" + std::to_string(food);
+	}
+};
+
+// Times hot Model and Controller operations in isolation over a matrix of square map sizes and densities
+class Benchmark
+{
+public:
+	struct Case
+	{
+		std::string name;
+
+		// Relative cost of one iteration given cells and entities; only used to skip hopeless cases
+		std::function<double(double cells, double entities)> work;
+
+		// Runs untimed before each iteration
+		std::function<void()> prepare;
+		std::function<void()> run;
+	};
+
+private:
+	std::vector<int> sizes;
+	std::vector<double> densities;
+	unsigned long long seed;
+	double caseSeconds;
+	double maxIterationSeconds;
+
+	std::vector<BenchmarkResult> results;
+
+	// Keeps the optimizer from discarding results
+	volatile size_t sink;
+
+	struct Measured
+	{
+		double work;
+		double seconds;
+		double exponent;
+	};
+
+	std::vector<std::pair<std::string, Measured>> lastMeasured;
+
+	Measured* findMeasured(const std::string& name)
+	{
+		for (auto& measured : lastMeasured)
+			if (measured.first == name)
+				return &measured.second;
+
+		return nullptr;
+	}
+
+	void measure(Case& benchmarkCase, int size, double density, int entities)
+	{
+		BenchmarkResult result;
+		result.name = benchmarkCase.name;
+		result.size = size;
+		result.density = density;
+		result.entities = entities;
+
+		double work = std::max(1.0, benchmarkCase.work((double)size * size, entities));
+		Measured* previous = findMeasured(benchmarkCase.name);
+
+		// Extrapolates with the growth exponent seen between the last two sizes, since the estimates undercount set copies
+		if (previous)
+		{
+			double ratio = std::max(1.0, work / previous->work);
+			result.predictedSeconds = previous->seconds * std::pow(ratio, previous->exponent);
+
+			if (result.predictedSeconds > maxIterationSeconds)
+			{
+				result.skipped = true;
+				results.push_back(result);
+				return;
+			}
+		}
+
+		std::vector<double> samples;
+		auto start = std::chrono::steady_clock::now();
+
+		while (samples.empty() || (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < caseSeconds && samples.size() < 1000000))
+		{
+			if (benchmarkCase.prepare)
+				benchmarkCase.prepare();
+
+			auto begin = std::chrono::steady_clock::now();
+			benchmarkCase.run();
+			auto end = std::chrono::steady_clock::now();
+
+			samples.push_back(std::chrono::duration<double, std::nano>(end - begin).count());
+		}
+
+		double total = 0;
+
+		for (double sample : samples)
+			total += sample;
+
+		std::sort(samples.begin(), samples.end());
+
+		result.iterations = (long long)samples.size();
+		result.meanNanoseconds = total / samples.size();
+		result.medianNanoseconds = samples[samples.size() / 2];
+		result.minNanoseconds = samples.front();
+
+		results.push_back(result);
+
+		Measured measured = { work, result.meanNanoseconds / 1e9, 1 };
+
+		if (previous && work > previous->work * 1.5 && previous->seconds > 0)
+			measured.exponent = std::max(1.0, std::log(measured.seconds / previous->seconds) / std::log(work / previous->work));
+
+		if (previous)
+			*previous = measured;
+		else
+			lastMeasured.push_back(std::make_pair(benchmarkCase.name, measured));
+	}
+
+	static void writeString(std::ostream& out, const std::string& text)
+	{
+		out << '"';
+
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+				out << '\\';
+
+			out << c;
+		}
+
+		out << '"';
+	}
+
+public:
+	// Starts from a tiny populated model so the large map is never populated cell by cell through sets
+	static std::unique_ptr<Model> createWorld(int size, double density, unsigned long long seed, const PopulationMix& mix = PopulationMix())
+	{
+		std::unique_ptr<Model> model(new Model(8, 8, seed));
+		model->clearEntities();
+		model->setLastId(0);
+		model->setMapSize(size, size);
+
+		RandomEngine& random = model->getRandom();
+		unsigned long long threshold = (unsigned long long)(density * 1000000);
+
+		for (int y = 1; y <= size; y++)
+			for (int x = 1; x <= size; x++)
+			{
+				if ((unsigned long long)MathUtility::randomInt(random, 1, 1000000) > threshold)
+					continue;
+
+				Position pos(x, y);
+				int kind = MathUtility::randomInt(random, 1, mix.getTotal());
+				bool isMale = MathUtility::randomInt(random, 0, 1) == 1;
+
+				if (kind <= mix.plantEating)
+					isMale ? model->addPlantEatingMale(pos) : model->addPlantEatingFemale(pos);
+				else if (kind <= mix.plantEating + mix.predator)
+					isMale ? model->addPredatorMale(pos) : model->addPredatorFemale(pos);
+				else if (kind <= mix.plantEating + mix.predator + mix.plant)
+					model->addPlant(pos);
+				else
+					model->addFood(pos);
+			}
+
+		return model;
+	}
+
+	Benchmark(unsigned long long seed) : sizes({ 20, 63, 200, 632, 2000 }), densities({ 0.01, 0.1 }), seed(seed),
+		caseSeconds(0.25), maxIterationSeconds(2), sink(0) {}
+
+	void setSizes(std::vector<int> newSizes) { sizes = newSizes; }
+	void setDensities(std::vector<double> newDensities) { densities = newDensities; }
+	void setCaseSeconds(double seconds) { caseSeconds = seconds; }
+	void setMaxIterationSeconds(double seconds) { maxIterationSeconds = seconds; }
+
+	const std::vector<BenchmarkResult>& getResults() { return results; }
+
+	void run(std::function<void(const BenchmarkResult&)> progress = nullptr)
+	{
+		results.clear();
+
+		for (double density : densities)
+		{
+			lastMeasured.clear();
+
+			for (int size : sizes)
+			{
+				std::unique_ptr<Model> world = createWorld(size, density, seed);
+				Model* model = world.get();
+
+				std::vector<Entity*> entities(model->getEntities().begin(), model->getEntities().end());
+				RandomEngine picker(seed);
+
+				if (entities.empty())
+					continue;
+
+				Entity* entity = nullptr;
+				Position pos;
+				std::set<Entity*> alive;
+				std::set<Entity*> eatable;
+				std::string serialization = model->getSerealization();
+				std::unique_ptr<Model> target;
+				std::unique_ptr<Model> fork;
+				std::unique_ptr<View> forkView;
+				std::unique_ptr<Controller> forkController;
+
+				auto pickEntity = [&]()
+				{
+					entity = entities[MathUtility::randomInt(picker, 0, (int)entities.size() - 1)];
+					pos = entity->getPosition();
+				};
+
+				std::vector<Case> cases =
+				{
+					{ "getFreeAdjacent", [](double cells, double) { return cells; }, pickEntity,
+						[&]() { sink += model->getFreeAdjacent(pos).size(); } },
+
+					{ "getDangerLevel", [](double, double entities) { return entities; }, pickEntity,
+						[&]() { sink += model->getDangerLevel(pos); } },
+
+					{ "getSafePlaces", [](double cells, double entities) { return cells * entities; }, nullptr,
+						[&]() { sink += model->getSafePlaces().size(); } },
+
+					// The plant eating SEARCHINGFOREAT filter chain from Controller::actOfPlantEating
+					{ "getClosest eatable", [](double, double entities) { return entities; }, pickEntity,
+						[&]()
+						{
+							sink += (size_t)model->getClosest(
+								SetUtility::Intersection(
+									SetUtility::Intersection(model->getAlive(), model->getEatable()),
+									SetUtility::Union(model->getFood(), model->getPlants())), entity);
+						}
+					},
+
+					// The predator SEARCHINGFORPAIR filter chain from Controller::actOfPredator
+					{ "getClosest pair", [](double, double entities) { return entities; }, pickEntity,
+						[&]()
+						{
+							sink += (size_t)model->getClosest(
+								SetUtility::Intersection(
+									SetUtility::Intersection(
+										SetUtility::Intersection(
+											model->getAlive(), model->getReproducable()), model->getAnimals()), model->getPredators()), entity);
+						}
+					},
+
+					{ "getById", [](double, double entities) { return entities; }, pickEntity,
+						[&]() { sink += (size_t)model->getById(entity->getId()); } },
+
+					{ "SetUtility::Intersection", [](double, double entities) { return entities; },
+						[&]()
+						{
+							alive = model->getAlive();
+							eatable = model->getEatable();
+						},
+						[&]() { sink += SetUtility::Intersection(alive, eatable).size(); } },
+
+					{ "nextStateOfModel", [](double cells, double entities) { return entities * (cells + entities); },
+						[&]()
+						{
+							forkController.reset();
+							forkView.reset();
+							fork.reset(model->fork());
+							forkView.reset(new View(fork.get()));
+							forkController.reset(new Controller(fork.get(), forkView.get()));
+						},
+						[&]() { forkController->nextStateOfModel(); } },
+
+					{ "getSerealization", [](double, double entities) { return entities; }, nullptr,
+						[&]() { sink += model->getSerealization().size(); } },
+
+					{ "deserealizeRepresentation", [](double, double entities) { return entities; },
+						[&]()
+						{
+							if (!target)
+							{
+								target.reset(new Model(8, 8, seed));
+								target->setMapSize(size, size);
+							}
+						},
+						[&]() { target->deserealizeRepresentation(serialization); } }
+				};
+
+				for (Case& benchmarkCase : cases)
+				{
+					measure(benchmarkCase, size, density, (int)entities.size());
+
+					if (progress)
+						progress(results.back());
+				}
+
+				forkController.reset();
+				forkView.reset();
+			}
+		}
+	}
+
+	void writeJson(std::ostream& out)
+	{
+		out << "{\n  \"seed\": " << seed << ",\n  \"case_seconds\": " << caseSeconds << ",\n  \"max_iteration_seconds\": " << maxIterationSeconds << ",\n  \"results\": [";
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const BenchmarkResult& result = results[i];
+
+			out << (i ? ",\n" : "\n") << "    { \"name\": ";
+			writeString(out, result.name);
+			out << ", \"size\": " << result.size << ", \"density\": " << result.density << ", \"entities\": " << result.entities;
+
+			if (result.skipped)
+				out << ", \"skipped\": true, \"predicted_seconds\": " << result.predictedSeconds << " }";
+			else
+				out << ", \"iterations\": " << result.iterations << ", \"mean_ns\": " << result.meanNanoseconds
+					<< ", \"median_ns\": " << result.medianNanoseconds << ", \"min_ns\": " << result.minNanoseconds << " }";
+		}
+
+		out << "\n  ]\n}\n";
+	}
+};
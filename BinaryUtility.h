@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+class BinaryUtility
+{
+public:
+	static void writeU16(unsigned char* out, unsigned short value)
+	{
+		out[0] = (unsigned char)value;
+		out[1] = (unsigned char)(value >> 8);
+	}
+
+	static void writeU32(unsigned char* out, unsigned int value)
+	{
+		out[0] = (unsigned char)value;
+		out[1] = (unsigned char)(value >> 8);
+		out[2] = (unsigned char)(value >> 16);
+		out[3] = (unsigned char)(value >> 24);
+	}
+
+	static void writeU64(unsigned char* out, unsigned long long value)
+	{
+		writeU32(out, (unsigned int)value);
+		writeU32(out + 4, (unsigned int)(value >> 32));
+	}
+
+	static unsigned short readU16(const unsigned char* in)
+	{
+		return (unsigned short)(in[0] | (in[1] << 8));
+	}
+
+	static unsigned int readU32(const unsigned char* in)
+	{
+		return (unsigned int)in[0] | ((unsigned int)in[1] << 8) | ((unsigned int)in[2] << 16) | ((unsigned int)in[3] << 24);
+	}
+
+	static unsigned long long readU64(const unsigned char* in)
+	{
+		return (unsigned long long)readU32(in) | ((unsigned long long)readU32(in + 4) << 32);
+	}
+
+	static void writeVarint(std::vector<unsigned char>& out, unsigned long long value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back((unsigned char)(value | 0x80));
+			value >>= 7;
+		}
+
+		out.push_back((unsigned char)value);
+	}
+
+	static unsigned long long readVarint(const unsigned char*& in, const unsigned char* end)
+	{
+		unsigned long long value = 0;
+
+		for (int shift = 0; in < end && shift < 64; shift += 7)
+		{
+			unsigned char byte = *in++;
+			value |= (unsigned long long)(byte & 0x7F) << shift;
+
+			if (!(byte & 0x80))
+				break;
+		}
+
+		return value;
+	}
+
+	static unsigned long long zigzag(long long value)
+	{
+		return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+	}
+
+	static long long unzigzag(unsigned long long value)
+	{
+		return (long long)(value >> 1) ^ -(long long)(value & 1);
+	}
+
+	static unsigned long long checksum(const unsigned char* data, size_t size)
+	{
+		const unsigned long long prime = 0x9E3779B185EBCA87ULL;
+
+		unsigned long long hash = 0xCBF29CE484222325ULL ^ size;
+
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			hash ^= readU64(data + i) * prime;
+			hash = ((hash << 31) | (hash >> 33)) * prime;
+		}
+
+		for (; i < size; i++)
+			hash = (hash ^ data[i]) * 0x100000001B3ULL;
+
+		hash ^= hash >> 29;
+		hash *= prime;
+		hash ^= hash >> 32;
+
+		return hash;
+	}
+};
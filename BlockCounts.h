@@ -0,0 +1,158 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "Position.h"
+#include "Entity.h"
+
+class BlockCounts
+{
+public:
+	enum Kind
+	{
+		PLANT_EATING,
+		PREDATOR,
+		PLANT,
+		FOOD,
+		KIND_COUNT
+	};
+
+private:
+	struct Level
+	{
+		int rows;
+		int columns;
+		std::vector<int> counts;
+	};
+
+	int height;
+	int width;
+	std::vector<Level> levels;
+
+	void countIn(int level, int blockRow, int blockColumn, int left, int bottom, int right, int top, int* counts)
+	{
+		Level& current = levels[level];
+
+		if (blockRow >= current.rows || blockColumn >= current.columns)
+			return;
+
+		int firstRow = blockRow << level;
+		int firstColumn = blockColumn << level;
+		int lastRow = firstRow + (1 << level) - 1;
+		int lastColumn = firstColumn + (1 << level) - 1;
+
+		if (lastRow < bottom || firstRow > top || lastColumn < left || firstColumn > right)
+			return;
+
+		if (firstRow >= bottom && lastRow <= top && firstColumn >= left && lastColumn <= right)
+		{
+			const int* block = getBlock(level, blockRow, blockColumn);
+
+			for (int kind = 0; kind < KIND_COUNT; kind++)
+				counts[kind] += block[kind];
+
+			return;
+		}
+
+		for (int row = blockRow * 2; row <= blockRow * 2 + 1; row++)
+			for (int column = blockColumn * 2; column <= blockColumn * 2 + 1; column++)
+				countIn(level - 1, row, column, left, bottom, right, top, counts);
+	}
+
+public:
+	BlockCounts() : height(0), width(0) {}
+
+	BlockCounts(int height, int width)
+	{
+		resize(height, width);
+	}
+
+	static Kind kindOf(Entity* entity)
+	{
+		if (entity->isAnimal())
+			return entity->isPredator() ? PREDATOR : PLANT_EATING;
+
+		return entity->isPlant() ? PLANT : FOOD;
+	}
+
+	void resize(int newHeight, int newWidth)
+	{
+		height = newHeight;
+		width = newWidth;
+
+		levels.clear();
+
+		int blockSize = 1;
+
+		while (true)
+		{
+			Level level;
+			level.rows = (height + blockSize - 1) / blockSize;
+			level.columns = (width + blockSize - 1) / blockSize;
+			level.counts.assign((size_t)level.rows * level.columns * KIND_COUNT, 0);
+
+			levels.push_back(level);
+
+			if (level.rows <= 1 && level.columns <= 1)
+				break;
+
+			blockSize *= 2;
+		}
+	}
+
+	void clear()
+	{
+		for (Level& level : levels)
+			level.counts.assign(level.counts.size(), 0);
+	}
+
+	void add(Position pos, Kind kind, int delta)
+	{
+		int row = pos.getY() - 1;
+		int column = pos.getX() - 1;
+
+		if (row < 0 || row >= height || column < 0 || column >= width)
+			return;
+
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			Level& level = levels[i];
+			level.counts[((size_t)(row >> i) * level.columns + (column >> i)) * KIND_COUNT + kind] += delta;
+		}
+	}
+
+	int countAt(Position pos)
+	{
+		int row = pos.getY() - 1;
+		int column = pos.getX() - 1;
+
+		if (row < 0 || row >= height || column < 0 || column >= width)
+			return 0;
+
+		const int* counts = getBlock(0, row, column);
+
+		return counts[PLANT_EATING] + counts[PREDATOR] + counts[PLANT] + counts[FOOD];
+	}
+
+	// Adds per-kind counts inside the inclusive 1-based rectangle, descending the pyramid only along its edges
+	void countIn(int left, int bottom, int right, int top, int* counts)
+	{
+		left = std::max(left, 1) - 1;
+		bottom = std::max(bottom, 1) - 1;
+		right = std::min(right, width) - 1;
+		top = std::min(top, height) - 1;
+
+		if (left > right || bottom > top || levels.empty())
+			return;
+
+		countIn((int)levels.size() - 1, 0, 0, left, bottom, right, top, counts);
+	}
+
+	int getRows(int level) { return levels[level].rows; }
+	int getColumns(int level) { return levels[level].columns; }
+
+	const int* getBlock(int level, int blockRow, int blockColumn)
+	{
+		Level& current = levels[level];
+		return current.counts.data() + ((size_t)blockRow * current.columns + blockColumn) * KIND_COUNT;
+	}
+};
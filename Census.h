@@ -0,0 +1,113 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "Entity.h"
+#include "BlockCounts.h"
+#include "EntityQuery.h"
+
+// World-wide counts and exact value histograms per kind, sex and state, kept current by deltas like PopulationStats
+class Census
+{
+public:
+	enum Metric
+	{
+		OLD,
+		HEALTH,
+		HUNGER,
+		METRIC_COUNT
+	};
+
+	static const int SEX_COUNT = 2;
+	static const int CELL_COUNT = BlockCounts::KIND_COUNT * SEX_COUNT * EntityQuery::STATE_COUNT;
+	static const int BUCKET_COUNT = 64;
+
+private:
+	std::vector<int> counts;
+	std::vector<int> histograms;
+
+	static int cellOf(int kind, int sex, int state)
+	{
+		return (kind * SEX_COUNT + sex) * EntityQuery::STATE_COUNT + state;
+	}
+
+	static bool matches(const EntityQuery& filter, int kind, int sex, int state)
+	{
+		if (filter.kind != EntityQuery::ANY && filter.kind != kind)
+			return false;
+
+		if (filter.sex != EntityQuery::ANY && (filter.sex != sex || (kind != BlockCounts::PLANT_EATING && kind != BlockCounts::PREDATOR)))
+			return false;
+
+		return filter.state == EntityQuery::ANY || filter.state == state;
+	}
+
+public:
+	static int valueOf(Entity* entity, int metric)
+	{
+		switch (metric)
+		{
+		case HEALTH:
+			return entity->getHealth();
+
+		case HUNGER:
+			return entity->getHunger();
+		}
+
+		return entity->getOld();
+	}
+
+	Census() : counts(CELL_COUNT), histograms((size_t)CELL_COUNT * METRIC_COUNT * BUCKET_COUNT) {}
+
+	void clear()
+	{
+		std::fill(counts.begin(), counts.end(), 0);
+		std::fill(histograms.begin(), histograms.end(), 0);
+	}
+
+	void add(Entity* entity, int delta)
+	{
+		int sex = entity->isAnimal() && entity->isMale() ? EntityQuery::MALE : EntityQuery::FEMALE;
+		int state = std::max(0, std::min((int)entity->getState(), EntityQuery::STATE_COUNT - 1));
+		int cell = cellOf(BlockCounts::kindOf(entity), sex, state);
+
+		counts[cell] += delta;
+
+		for (int metric = 0; metric < METRIC_COUNT; metric++)
+		{
+			int bucket = std::max(0, std::min(valueOf(entity, metric), BUCKET_COUNT - 1));
+			histograms[((size_t)cell * METRIC_COUNT + metric) * BUCKET_COUNT + bucket] += delta;
+		}
+	}
+
+	int count(const EntityQuery& filter)
+	{
+		int total = 0;
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+			for (int sex = 0; sex < SEX_COUNT; sex++)
+				for (int state = 0; state < EntityQuery::STATE_COUNT; state++)
+					if (matches(filter, kind, sex, state))
+						total += counts[cellOf(kind, sex, state)];
+
+		return total;
+	}
+
+	// Fills BUCKET_COUNT entries; values past the last bucket are counted in it
+	void histogram(const EntityQuery& filter, int metric, std::vector<int>& buckets)
+	{
+		buckets.assign(BUCKET_COUNT, 0);
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+			for (int sex = 0; sex < SEX_COUNT; sex++)
+				for (int state = 0; state < EntityQuery::STATE_COUNT; state++)
+				{
+					if (!matches(filter, kind, sex, state))
+						continue;
+
+					const int* values = histograms.data() + ((size_t)cellOf(kind, sex, state) * METRIC_COUNT + metric) * BUCKET_COUNT;
+
+					for (int bucket = 0; bucket < BUCKET_COUNT; bucket++)
+						buckets[bucket] += values[bucket];
+				}
+	}
+};
@@ -0,0 +1,257 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include "EntityRecord.h"
+#include "Model.h"
+#include "Tracer.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+class Checkpointer
+{
+	struct Capture
+	{
+		int height;
+		int width;
+		int lastId;
+		long long tick;
+		unsigned long long randomState;
+		std::vector<EntityRecord> records;
+	};
+
+	std::string path;
+	long long everyTicks;
+	double everySeconds;
+
+	Capture staging;
+	Capture pending;
+	Capture writing;
+	bool hasPending;
+	bool stopping;
+
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::condition_variable idle;
+	bool busy;
+	std::thread writer;
+
+	std::vector<unsigned char> buffer;
+
+	long long lastTick;
+	std::chrono::steady_clock::time_point lastTime;
+
+	std::atomic<long long> writtenCount;
+	std::atomic<long long> failedCount;
+	std::atomic<long long> lastWrittenTick;
+	std::atomic<long long> lastCaptureMicroseconds;
+
+	// Returns only once the bytes have reached the disk, so a rename never exposes a half-written file after a crash
+	static bool writeFile(std::string to, const std::vector<unsigned char>& bytes)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(to.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		bool isWritten = true;
+
+		for (size_t done = 0; isWritten && done < bytes.size();)
+		{
+			DWORD count = 0;
+			isWritten = WriteFile(file, bytes.data() + done, (DWORD)std::min(bytes.size() - done, (size_t)(1 << 30)), &count, nullptr) && count > 0;
+			done += count;
+		}
+
+		isWritten = isWritten && FlushFileBuffers(file);
+
+		return CloseHandle(file) && isWritten;
+#else
+		int descriptor = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if (descriptor < 0)
+			return false;
+
+		bool isWritten = true;
+
+		for (size_t done = 0; isWritten && done < bytes.size();)
+		{
+			ssize_t count = ::write(descriptor, bytes.data() + done, bytes.size() - done);
+			isWritten = count > 0;
+			done += isWritten ? (size_t)count : 0;
+		}
+
+		isWritten = isWritten && fsync(descriptor) == 0;
+
+		return ::close(descriptor) == 0 && isWritten;
+#endif
+	}
+
+	static bool replaceFile(std::string from, std::string to)
+	{
+#ifdef _WIN32
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+		if (std::rename(from.c_str(), to.c_str()) != 0)
+			return false;
+
+		// The rename itself lives in the directory, which needs its own sync to survive a crash
+		size_t slash = to.find_last_of('/');
+		std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : to.substr(0, slash);
+		int descriptor = ::open(directory.c_str(), O_RDONLY);
+
+		if (descriptor < 0)
+			return false;
+
+		bool isSynced = fsync(descriptor) == 0;
+
+		return ::close(descriptor) == 0 && isSynced;
+#endif
+	}
+
+	bool write(Capture& capture)
+	{
+		TRACE_SCOPE("checkpoint write");
+
+		Model::saveBinary(buffer, capture.height, capture.width, capture.lastId, capture.tick, capture.randomState, capture.records);
+
+		std::string temporaryPath = path + ".tmp";
+
+		return writeFile(temporaryPath, buffer) && replaceFile(temporaryPath, path);
+	}
+
+	void run()
+	{
+		Tracer::setThreadName("checkpoint writer");
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (true)
+		{
+			wakeUp.wait(lock, [this]() { return hasPending || stopping; });
+
+			if (!hasPending)
+				break;
+
+			std::swap(pending, writing);
+			hasPending = false;
+			busy = true;
+
+			lock.unlock();
+
+			if (write(writing))
+			{
+				writtenCount++;
+				lastWrittenTick = writing.tick;
+			}
+
+			else
+				failedCount++;
+
+			lock.lock();
+			busy = false;
+			idle.notify_all();
+		}
+	}
+
+public:
+	Checkpointer(std::string path, long long everyTicks = 0, double everySeconds = 0)
+		: path(path), everyTicks(everyTicks), everySeconds(everySeconds), hasPending(false), stopping(false), busy(false),
+		lastTick(0), writtenCount(0), failedCount(0), lastWrittenTick(-1), lastCaptureMicroseconds(0)
+	{
+		lastTime = std::chrono::steady_clock::now();
+		writer = std::thread(&Checkpointer::run, this);
+	}
+
+	~Checkpointer()
+	{
+		close();
+	}
+
+	void attach(Model* model)
+	{
+		lastTick = model->getTick();
+
+		model->addTickListener([this](Model* m)
+			{
+				this->onTick(m);
+			}
+		);
+	}
+
+	void onTick(Model* model)
+	{
+		bool ticksAreDue = everyTicks > 0 && model->getTick() - lastTick >= everyTicks;
+		bool timeIsDue = everySeconds > 0
+			&& std::chrono::duration<double>(std::chrono::steady_clock::now() - lastTime).count() >= everySeconds;
+
+		if (ticksAreDue || timeIsDue)
+			checkpoint(model);
+	}
+
+	void checkpoint(Model* model)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		staging.height = model->getMap()->getHeight();
+		staging.width = model->getMap()->getWidth();
+		staging.lastId = model->getLastId();
+		staging.tick = model->getTick();
+		staging.randomState = model->getRandom().getState();
+		model->getRecords(staging.records);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			std::swap(staging, pending);
+			hasPending = true;
+		}
+
+		wakeUp.notify_one();
+
+		lastTick = model->getTick();
+		lastTime = std::chrono::steady_clock::now();
+		lastCaptureMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(lastTime - start).count();
+	}
+
+	void flush()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this]() { return !hasPending && !busy; });
+	}
+
+	void close()
+	{
+		if (!writer.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		wakeUp.notify_one();
+		writer.join();
+	}
+
+	std::string getPath() { return path; }
+	long long getWrittenCount() { return writtenCount; }
+	long long getFailedCount() { return failedCount; }
+	long long getLastWrittenTick() { return lastWrittenTick; }
+	long long getLastCaptureMicroseconds() { return lastCaptureMicroseconds; }
+};
@@ -0,0 +1,191 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <charconv>
+#include <cctype>
+#include <sstream>
+
+struct ConsoleArgument
+{
+	std::string text;
+	int number;
+};
+
+class Console
+{
+public:
+	enum ArgumentType
+	{
+		INTEGER = 'i',
+		WORD = 's',
+		OPTIONAL = '|'
+	};
+
+	typedef std::function<void(const std::vector<ConsoleArgument>&)> Callback;
+
+	struct Command
+	{
+		std::string signature;
+		Callback callback;
+	};
+
+	struct Call
+	{
+		const Command* command;
+		std::vector<ConsoleArgument> arguments;
+		std::string source;
+		int line;
+	};
+
+private:
+	std::unordered_map<std::string, Command> commands;
+
+	static void split(const std::string& line, std::vector<std::string>& tokens)
+	{
+		tokens.clear();
+
+		size_t i = 0;
+
+		while (i < line.size())
+		{
+			while (i < line.size() && std::isspace((unsigned char)line[i]))
+				i++;
+
+			size_t start = i;
+
+			while (i < line.size() && !std::isspace((unsigned char)line[i]))
+				i++;
+
+			if (i > start)
+				tokens.push_back(line.substr(start, i - start));
+		}
+	}
+
+public:
+	Console() {}
+
+	void addCommand(std::string name, std::string signature, Callback callback)
+	{
+		Command command;
+		command.signature = signature;
+		command.callback = callback;
+
+		commands[name] = command;
+	}
+
+	// Returns false with an error for malformed lines; blank lines and '#' comments parse to no call
+	bool parse(const std::string& line, std::vector<Call>& calls, std::string& error)
+	{
+		std::vector<std::string> tokens;
+		split(line, tokens);
+
+		if (tokens.empty() || tokens[0][0] == '#')
+			return true;
+
+		auto found = commands.find(tokens[0]);
+
+		if (found == commands.end())
+		{
+			error = "unknown command '" + tokens[0] + "'";
+			return false;
+		}
+
+		const Command& command = found->second;
+
+		// Arguments after OPTIONAL in a signature may be omitted
+		size_t optional = command.signature.find(OPTIONAL);
+		std::string types = command.signature;
+		size_t required = types.size();
+
+		if (optional != std::string::npos)
+		{
+			types.erase(optional, 1);
+			required = optional;
+		}
+
+		size_t count = tokens.size() - 1;
+
+		if (count < required || count > types.size())
+		{
+			std::string expected = std::to_string(required);
+
+			if (required != types.size())
+				expected += "-" + std::to_string(types.size());
+
+			error = tokens[0] + " expects " + expected + " argument(s)";
+			return false;
+		}
+
+		Call call;
+		call.command = &command;
+		call.arguments.resize(count);
+		call.line = 0;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			ConsoleArgument& argument = call.arguments[i];
+			const std::string& token = tokens[i + 1];
+
+			argument.text = token;
+			argument.number = 0;
+
+			if (types[i] != INTEGER)
+				continue;
+
+			auto result = std::from_chars(token.data(), token.data() + token.size(), argument.number);
+
+			if (result.ec != std::errc() || result.ptr != token.data() + token.size())
+			{
+				error = tokens[0] + ": '" + token + "' is not an integer";
+				return false;
+			}
+		}
+
+		calls.push_back(call);
+
+		return true;
+	}
+
+	// Parses every line of the stream, collecting "source:line: message" errors
+	void parseAll(std::istream& in, std::string source, std::vector<Call>& calls, std::vector<std::string>& errors)
+	{
+		std::string line;
+		std::string error;
+		int number = 0;
+
+		while (std::getline(in, line))
+		{
+			number++;
+			size_t parsed = calls.size();
+
+			if (!parse(line, calls, error))
+				errors.push_back(getLocation(source, number) + error);
+
+			else if (calls.size() > parsed)
+			{
+				calls.back().source = source;
+				calls.back().line = number;
+			}
+		}
+	}
+
+	// The "source:line: " prefix shared by parse and runtime errors
+	static std::string getLocation(const std::string& source, int line)
+	{
+		return source.empty() ? std::string() : source + ":" + std::to_string(line) + ": ";
+	}
+
+	// Calls before with each call ahead of running it, so runtime errors can name their line
+	static void execute(const std::vector<Call>& calls, std::function<void(const Call&)> before = nullptr)
+	{
+		for (const Call& call : calls)
+		{
+			if (before)
+				before(call);
+
+			call.command->callback(call.arguments);
+		}
+	}
+};
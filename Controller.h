@@ -1,12 +1,26 @@
 #pragma once
 #include <sstream>
+#include <fstream>
 #include <stack>
+#include <unordered_set>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include "MathUtility.h"
 #include "SetUtility.h"
 #include "KeyboardUtility.h"
+#include "Console.h"
+#include "Profiler.h"
+#include "PerfCounters.h"
 #include "Model.h"
 #include "ViewState.h"
 #include "View.h"
+#include "WorldSnapshot.h"
 #include "EntityState.h"
 #include "Entity.h"
 
@@ -26,174 +40,894 @@ protected:
 		return pos.getX() + pos.getY() + model->getDangerLevel(pos);
 	}
 
-	class Console
+	static const int MAX_SCRIPT_DEPTH = 8;
+
+	Console consoleHandlers;
+	std::vector<std::string>* consoleErrors;
+	std::vector<std::string>* consoleOutput;
+	std::string consoleLocation;
+	AllocationTickStats allocationTicks;
+	PerfCounters perf;
+	int scriptDepth;
+
+	// Reused every tick so collecting the dead allocates only when the set grows
+	std::unordered_set<Entity*> diedEntities;
+
+	std::thread simulationThread;
+	std::thread renderThread;
+
+	std::atomic<bool> stopping;
+	std::atomic<bool> simulationIsRunning;
+	std::atomic<long long> tickIntervalMicroseconds;
+	std::atomic<long long> frameIntervalMicroseconds;
+
+	std::atomic<bool> autoplayIsEnabled;
+	std::atomic<bool> maxSpeedIsEnabled;
+	std::atomic<bool> statusIsChanged;
+
+	static constexpr double PUBLISH_BUDGET = 0.05;
+	static constexpr double AVERAGE_WEIGHT = 0.1;
+
+	double averageTickMicroseconds;
+	double averagePublishMicroseconds;
+	long long ticksSincePublish;
+
+	long long measuredTicks;
+	double measuredTicksPerSecond;
+	std::chrono::steady_clock::time_point measureStart;
+
+	std::mutex commandsMutex;
+	std::condition_variable commandsChanged;
+	std::condition_variable commandsApplied;
+	std::vector<std::function<void()>> commands;
+	long long queuedCommandCount;
+	long long appliedCommandCount;
+
+	long long publishedRequestVersion;
+	bool worldIsDirty;
+
+	bool requestIsChanged()
 	{
-		std::vector<std::string> commands;
-		std::vector<std::pair<int, std::function<void(int, int)>*>> callbacks;
+		return view->getRequestVersion() != publishedRequestVersion;
+	}
 
-	public:
-		Console() {}
+	static void average(double& value, double sample)
+	{
+		value = value > 0 ? value + (sample - value) * AVERAGE_WEIGHT : sample;
+	}
 
-		Console(std::vector<std::string> commandsList)
-		{
-			commands = commandsList;
-			callbacks = std::vector<std::pair<int, std::function<void(int, int)>*>>(commands.size());
+	void publish()
+	{
+		auto start = std::chrono::steady_clock::now();
 
-			for (int i = 0; i < commands.size(); i++)
-			{
-				callbacks[i].first = 0;
-				callbacks[i].second = nullptr;
-			}
-		}
+		publishedRequestVersion = view->getRequestVersion();
+		worldIsDirty = false;
+		ticksSincePublish = 0;
 
-		void setCallback(int commandNumber, int argumentCount, std::function<void(int, int)> callbackFunction)
-		{
-			if (commandNumber < 1 || commandNumber > commands.size())
-				return;
+		EntityQuery query = view->getInfoQuery();
 
-			if (argumentCount < 0)
-				return;
+		std::shared_ptr<WorldSnapshot> snapshot = WorldSnapshot::capture(model, view->getViewport(), view->areRecordsNeeded() ? &query : nullptr);
+		snapshot->status = getStatus();
 
-			callbacks[commandNumber - 1].first = argumentCount;
-			callbacks[commandNumber - 1].second = new std::function<void(int, int)>(callbackFunction);
-		}
+		view->publish(snapshot);
 
-		void addCommand(std::string commandName, int argumentCount, std::function<void(int, int)> callbackFunction)
-		{
-			commands.push_back(commandName);
+		average(averagePublishMicroseconds, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
 
-			std::pair<int, std::function<void(int, int)> *> newCallback;
+	void simulateTick()
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		nextStateOfModel();
+
+		auto end = std::chrono::steady_clock::now();
+		average(averageTickMicroseconds, std::chrono::duration<double, std::micro>(end - start).count());
+
+		worldIsDirty = true;
+		ticksSincePublish++;
+		measuredTicks++;
 
-			newCallback.first = argumentCount;
-			newCallback.second = new std::function<void(int, int)>(callbackFunction);
+		double elapsed = std::chrono::duration<double>(end - measureStart).count();
 
-			callbacks.push_back(newCallback);
+		if (elapsed >= 1)
+		{
+			measuredTicksPerSecond = measuredTicks / elapsed;
+			measuredTicks = 0;
+			measureStart = end;
 		}
+	}
+
+	long long getPublishEvery()
+	{
+		if (!maxSpeedIsEnabled)
+			return 1;
+
+		double tick = std::max(averageTickMicroseconds, 1.0);
+
+		long long byBudget = (long long)std::ceil(averagePublishMicroseconds / (PUBLISH_BUDGET * tick));
+		long long byFrames = (long long)std::ceil(frameIntervalMicroseconds / tick);
+
+		return std::max(1LL, std::max(byBudget, byFrames));
+	}
+
+	std::string getStatus()
+	{
+		char status[64];
+
+		if (!simulationIsRunning)
+			std::snprintf(status, sizeof(status), "paused");
+
+		else if (maxSpeedIsEnabled)
+			std::snprintf(status, sizeof(status), "max %.0f tps 1/%lld", measuredTicksPerSecond, getPublishEvery());
+
+		else
+			std::snprintf(status, sizeof(status), "play %.0f tps", measuredTicksPerSecond);
+
+		return status;
+	}
+
+	void fastForward(long long ticks)
+	{
+		for (long long i = 0; i < ticks && !stopping; i++)
+			simulateTick();
+	}
+
+	bool applyCommands()
+	{
+		std::vector<std::function<void()>> batch;
 
-		void applyCommand(int commandNumber)
 		{
-			if (callbacks[commandNumber - 1].first != 0)
-				return;
+			std::lock_guard<std::mutex> lock(commandsMutex);
+			batch.swap(commands);
+		}
+
+		if (batch.empty())
+			return false;
 
-			std::function<void(int, int)> callback = *callbacks[commandNumber - 1].second;
-			callback(-1, -1);
+		TRACE_SCOPE("command batch");
+		TRACE_COUNTER("command batch size", batch.size());
+
+		for (std::function<void()>& command : batch)
+			command();
+
+		{
+			std::lock_guard<std::mutex> lock(commandsMutex);
+			appliedCommandCount += batch.size();
 		}
 
-		void applyCommand(int commandNumber, int firstArg, int secondArg)
+		commandsApplied.notify_all();
+
+		return true;
+	}
+
+	void simulationLoop()
+	{
+		Tracer::setThreadName("simulation");
+
+		auto nextTick = std::chrono::steady_clock::now();
+
+		while (!stopping)
 		{
-			if (callbacks[commandNumber - 1].first != 2)
-				return;
+			if (applyCommands())
+				worldIsDirty = true;
+
+			auto now = std::chrono::steady_clock::now();
+			bool isRunning = simulationIsRunning;
+			bool isMaxSpeed = maxSpeedIsEnabled;
+
+			if (isRunning && (isMaxSpeed || now >= nextTick))
+			{
+				simulateTick();
+
+				nextTick += std::chrono::microseconds(tickIntervalMicroseconds.load());
 
-			std::function<void(int, int)> callback = *callbacks[commandNumber - 1].second;
-			callback(firstArg, secondArg);
+				if (nextTick < now)
+					nextTick = now;
+			}
+
+			if (statusIsChanged.exchange(false) || requestIsChanged()
+				|| (worldIsDirty && (!isRunning || (view->isSnapshotConsumed() && ticksSincePublish >= getPublishEvery()))))
+				publish();
+
+			if (isRunning && isMaxSpeed)
+				continue;
+
+			auto wakeUp = isRunning ? nextTick : now + std::chrono::milliseconds(10);
+
+			if (!isRunning)
+				nextTick = wakeUp;
+
+			std::unique_lock<std::mutex> lock(commandsMutex);
+			commandsChanged.wait_until(lock, wakeUp, [this]() { return !commands.empty() || stopping || requestIsChanged(); });
 		}
+	}
+
+	void renderLoop()
+	{
+		Tracer::setThreadName("render");
+
+		auto nextFrame = std::chrono::steady_clock::now();
 
-		void applyCommandByName(std::string command, int firstArg, int secondArg)
+		while (!stopping)
 		{
-			int index;
+			{
+				PROFILE_SCOPE(PHASE_RENDER);
+
+				auto start = std::chrono::steady_clock::now();
+				view->render();
+				perf.recordRender((long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			}
 
-			for (index = 0; index < commands.size(); index++)
-				if (command == commands[index])
-					break;
-			
-			if (index == commands.size())
-				return;
+			auto now = std::chrono::steady_clock::now();
+			nextFrame += std::chrono::microseconds(frameIntervalMicroseconds.load());
 
-			applyCommand(index + 1, firstArg, secondArg);
+			if (nextFrame < now)
+				nextFrame = now;
+
+			std::this_thread::sleep_until(nextFrame);
 		}
+	}
 
-		void applyCommandByName(std::string command)
-		{
-			int index;
+public:
+	Controller(Model* m, View* v) : model(m), view(v), consoleErrors(nullptr), consoleOutput(nullptr), scriptDepth(0), stopping(false), simulationIsRunning(false),
+		tickIntervalMicroseconds(100000), frameIntervalMicroseconds(1000000 / 30), autoplayIsEnabled(true), maxSpeedIsEnabled(false), statusIsChanged(false),
+		averageTickMicroseconds(0), averagePublishMicroseconds(0), ticksSincePublish(0), measuredTicks(0), measuredTicksPerSecond(0),
+		queuedCommandCount(0), appliedCommandCount(0), publishedRequestVersion(-1), worldIsDirty(true)
+	{
+		measureStart = std::chrono::steady_clock::now();
 
-			for (index = 0; index < commands.size(); index++)
-				if (command == commands[index])
-					break;
+		view->setPerfCounters(&perf);
+		initConsole();
+	}
 
-			if (index == commands.size())
-				return;
+	const AllocationTickStats& getAllocationTicks() { return allocationTicks; }
+	PerfCounters* getPerf() { return &perf; }
 
-			applyCommand(index + 1);
+	void setTickRate(double ticksPerSecond)
+	{
+		tickIntervalMicroseconds = ticksPerSecond > 0 ? (long long)(1000000 / ticksPerSecond) : 0;
+		commandsChanged.notify_all();
+	}
+
+	void setAutoplay(bool enabled)
+	{
+		autoplayIsEnabled = enabled;
+		statusIsChanged = true;
+		commandsChanged.notify_all();
+	}
+
+	void setMaxSpeed(bool enabled)
+	{
+		maxSpeedIsEnabled = enabled;
+		statusIsChanged = true;
+		commandsChanged.notify_all();
+	}
+
+	void setFrameRate(double framesPerSecond)
+	{
+		if (framesPerSecond > 0)
+			frameIntervalMicroseconds = (long long)(1000000 / framesPerSecond);
+	}
+
+	void runOnSimulationThread(std::function<void()> command)
+	{
+		if (!simulationThread.joinable())
+		{
+			command();
+			return;
 		}
-	};
 
-	Console consoleHandlers;
+		std::unique_lock<std::mutex> lock(commandsMutex);
 
-public:
-	Controller(Model* m, View* v) : model(m), view(v) { initConsole(); }
+		commands.push_back(command);
+		long long ticket = ++queuedCommandCount;
+
+		TRACE_COUNTER("command queue", commands.size());
+
+		commandsChanged.notify_all();
+		commandsApplied.wait(lock, [this, ticket]() { return appliedCommandCount >= ticket || stopping; });
+	}
 
 	virtual void initConsole()
 	{
-		std::vector<std::string> commandsList =
-		{"observe", "info", "addplanteatingmale", "addplanteatingfemale",
-		 "addpredatormale", "addpredatorfemale", "addplant", "addfood",
-		 "delete"};
+		consoleHandlers = Console();
 
-		consoleHandlers = Console(commandsList);
-
-		consoleHandlers.setCallback(1, 0, [=](int, int)
+		consoleHandlers.addCommand("observe", "", [=](const std::vector<ConsoleArgument>&)
 			{
 				view->setObserveCommand();
 			}
 		);
 
-		consoleHandlers.setCallback(2, 0, [=](int, int)
+		consoleHandlers.addCommand("info", "", [=](const std::vector<ConsoleArgument>&)
 			{
 				view->setInfoCommand();
 			}
 		);
 
-		consoleHandlers.setCallback(3, 2, [=](int a, int b)
+		consoleHandlers.addCommand("addplanteatingmale", "ii", [=](const std::vector<ConsoleArgument>& args)
+			{
+				model->addPlantEatingMale(Position(args[0].number, args[1].number));
+			}
+		);
+
+		consoleHandlers.addCommand("addplanteatingfemale", "ii", [=](const std::vector<ConsoleArgument>& args)
+			{
+				model->addPlantEatingFemale(Position(args[0].number, args[1].number));
+			}
+		);
+
+		consoleHandlers.addCommand("addpredatormale", "ii", [=](const std::vector<ConsoleArgument>& args)
+			{
+				model->addPredatorMale(Position(args[0].number, args[1].number));
+			}
+		);
+
+		consoleHandlers.addCommand("addpredatorfemale", "ii", [=](const std::vector<ConsoleArgument>& args)
 			{
-				model->addPlantEatingMale(Position(a, b));
+				model->addPredatorFemale(Position(args[0].number, args[1].number));
 			}
 		);
 
-		consoleHandlers.setCallback(4, 2, [=](int a, int b)
+		consoleHandlers.addCommand("addplant", "ii", [=](const std::vector<ConsoleArgument>& args)
 			{
-				model->addPlantEatingFemale(Position(a, b));
+				model->addPlant(Position(args[0].number, args[1].number));
 			}
 		);
 
-		consoleHandlers.setCallback(5, 2, [=](int a, int b)
+		consoleHandlers.addCommand("addfood", "ii", [=](const std::vector<ConsoleArgument>& args)
 			{
-				model->addPredatorMale(Position(a, b));
+				model->addFood(Position(args[0].number, args[1].number));
 			}
 		);
 
-		consoleHandlers.setCallback(6, 2, [=](int a, int b)
+		consoleHandlers.addCommand("delete", "ii", [=](const std::vector<ConsoleArgument>& args)
 			{
-				model->addPredatorFemale(Position(a, b));
+				Entity* ent = model->getIn(Position(args[0].number, args[1].number));
+
+				if (ent)
+					model->removeEntities({ ent });
+			}
+		);
+
+		consoleHandlers.addCommand("fill", "siiiii", [=](const std::vector<ConsoleArgument>& args)
+			{
+				fillRegion(args[0].text, Region::rectangle(args[1].number, args[2].number, args[3].number, args[4].number), args[5].number);
+			}
+		);
+
+		consoleHandlers.addCommand("fillcircle", "siiii", [=](const std::vector<ConsoleArgument>& args)
+			{
+				fillRegion(args[0].text, Region::circle(args[1].number, args[2].number, args[3].number), args[4].number);
 			}
 		);
 
-		consoleHandlers.setCallback(7, 2, [=](int a, int b)
+		consoleHandlers.addCommand("clear", "iiii|s", [=](const std::vector<ConsoleArgument>& args)
 			{
-				model->addPlant(Position(a, b));
+				clearRegion(Region::rectangle(args[0].number, args[1].number, args[2].number, args[3].number), args.size() > 4 ? args[4].text : "");
 			}
 		);
 
-		consoleHandlers.setCallback(8, 2, [=](int a, int b)
+		consoleHandlers.addCommand("clearcircle", "iii|s", [=](const std::vector<ConsoleArgument>& args)
 			{
-				model->addFood(Position(a, b));
+				clearRegion(Region::circle(args[0].number, args[1].number, args[2].number), args.size() > 3 ? args[3].text : "");
 			}
 		);
 
-		consoleHandlers.setCallback(9, 2, [=](int a, int b)
+		consoleHandlers.addCommand("scatter", "siiiii", [=](const std::vector<ConsoleArgument>& args)
 			{
-				Entity* ent = model->getIn(Position(a, b));
+				scatterRegion(args[0].text, args[1].number, Region::rectangle(args[2].number, args[3].number, args[4].number, args[5].number));
+			}
+		);
 
-				handleDied(ent);
+		consoleHandlers.addCommand("scattercircle", "siiii", [=](const std::vector<ConsoleArgument>& args)
+			{
+				scatterRegion(args[0].text, args[1].number, Region::circle(args[2].number, args[3].number, args[4].number));
+			}
+		);
 
-				model->getEntities().erase(ent);
+		consoleHandlers.addCommand("count", "s|iiii", [=](const std::vector<ConsoleArgument>& args)
+			{
+				printCount(args);
+			}
+		);
+
+		consoleHandlers.addCommand("hist", "s|s", [=](const std::vector<ConsoleArgument>& args)
+			{
+				printHistogram(args);
+			}
+		);
+
+		consoleHandlers.addCommand("stats", "", [=](const std::vector<ConsoleArgument>&)
+			{
+				printStats();
+			}
+		);
+
+		consoleHandlers.addCommand("profile", "s", [=](const std::vector<ConsoleArgument>& args)
+			{
+				profile(args[0].text);
 			}
 		);
+
+		consoleHandlers.addCommand("allocations", "|s", [=](const std::vector<ConsoleArgument>& args)
+			{
+				printAllocations(args.empty() ? std::string() : args[0].text);
+			}
+		);
+
+		consoleHandlers.addCommand("perf", "|s", [=](const std::vector<ConsoleArgument>& args)
+			{
+				printPerf(args.empty() ? std::string() : args[0].text);
+			}
+		);
+
+		consoleHandlers.addCommand("ff", "i", [=](const std::vector<ConsoleArgument>& args)
+			{
+				fastForward(args[0].number);
+			}
+		);
+
+		consoleHandlers.addCommand("script", "s", [=](const std::vector<ConsoleArgument>& args)
+			{
+				executeScript(args[0].text);
+			}
+		);
+	}
+
+	void reportConsoleError(std::string error)
+	{
+		if (consoleErrors)
+			consoleErrors->push_back(consoleLocation + error);
+	}
+
+	void printConsole(std::string line)
+	{
+		if (consoleOutput)
+			consoleOutput->push_back(line);
+	}
+
+	// Kind and sex over a region come from the block pyramids; a state filter needs a scan of the entities
+	int countInRegion(EntityQuery filter, Region region)
+	{
+		if (filter.state != EntityQuery::ANY)
+		{
+			filter.hasRegion = true;
+			filter.left = region.left;
+			filter.bottom = region.bottom;
+			filter.right = region.right;
+			filter.top = region.top;
+
+			int total = 0;
+
+			for (Entity* entity : model->getEntities())
+				if (filter.matches(entity))
+					total++;
+
+			return total;
+		}
+
+		int all[BlockCounts::KIND_COUNT] = {};
+		int male[BlockCounts::KIND_COUNT] = {};
+
+		model->getBlockCounts()->countIn(region.left, region.bottom, region.right, region.top, all);
+
+		if (filter.sex != EntityQuery::ANY)
+			model->getMaleCounts()->countIn(region.left, region.bottom, region.right, region.top, male);
+
+		int total = 0;
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+		{
+			if (filter.kind != EntityQuery::ANY && filter.kind != kind)
+				continue;
+
+			if (filter.sex == EntityQuery::ANY)
+				total += all[kind];
+			else if (kind == BlockCounts::PLANT_EATING || kind == BlockCounts::PREDATOR)
+				total += filter.sex == EntityQuery::MALE ? male[kind] : all[kind] - male[kind];
+		}
+
+		return total;
 	}
 
-	void nextStep()
+	void printCount(const std::vector<ConsoleArgument>& args)
 	{
-		view->render();
-		controlUponState();
+		EntityQuery filter;
+		std::string error;
+
+		if (!filter.parseFilter(args[0].text, error))
+		{
+			reportConsoleError("count: " + error);
+			return;
+		}
+
+		if (args.size() != 1 && args.size() != 5)
+		{
+			reportConsoleError("count expects 1 or 5 argument(s)");
+			return;
+		}
+
+		if (args.size() == 1)
+		{
+			printConsole("count " + args[0].text + ": " + std::to_string(model->getCensus()->count(filter)));
+			return;
+		}
+
+		Region region = Region::rectangle(args[1].number, args[2].number, args[3].number, args[4].number);
+
+		printConsole("count " + args[0].text + " " + std::to_string(region.left) + "," + std::to_string(region.bottom) + "-" +
+			std::to_string(region.right) + "," + std::to_string(region.top) + ": " + std::to_string(countInRegion(filter, region)));
+	}
+
+	void printHistogram(const std::vector<ConsoleArgument>& args)
+	{
+		std::string metricName = args[0].text;
+		int metric = metricName == "age" || metricName == "old" ? Census::OLD : metricName == "health" ? Census::HEALTH : metricName == "hunger" ? Census::HUNGER : -1;
+
+		if (metric < 0)
+		{
+			reportConsoleError("hist: unknown metric '" + metricName + "'");
+			return;
+		}
+
+		EntityQuery filter;
+		std::string error;
+
+		if (args.size() > 1 && !filter.parseFilter(args[1].text, error))
+		{
+			reportConsoleError("hist: " + error);
+			return;
+		}
+
+		std::vector<int> buckets;
+		model->getCensus()->histogram(filter, metric, buckets);
+
+		std::string line = "hist " + metricName + (args.size() > 1 ? " " + args[1].text : std::string()) + ":";
+		int total = 0;
+
+		for (size_t value = 0; value < buckets.size(); value++)
+			if (buckets[value])
+			{
+				line += " " + std::to_string(value) + ((int)value == Census::BUCKET_COUNT - 1 ? "+" : "") + ":" + std::to_string(buckets[value]);
+				total += buckets[value];
+			}
+
+		printConsole(line + "  (n " + std::to_string(total) + ")");
+	}
+
+	void printStats()
+	{
+		Census* census = model->getCensus();
+		EntityQuery filter;
+
+		std::string kinds = "tick " + std::to_string(model->getTick()) + "  entities " + std::to_string(census->count(filter));
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+		{
+			filter.kind = kind;
+			filter.sex = EntityQuery::ANY;
+			kinds += "  " + std::string(EntityQuery::getKindName(kind)) + " " + std::to_string(census->count(filter));
+
+			if (kind != BlockCounts::PLANT_EATING && kind != BlockCounts::PREDATOR)
+				continue;
+
+			filter.sex = EntityQuery::MALE;
+			kinds += " (m " + std::to_string(census->count(filter));
+			filter.sex = EntityQuery::FEMALE;
+			kinds += " f " + std::to_string(census->count(filter)) + ")";
+		}
+
+		filter = EntityQuery();
+		std::string states = "states";
+
+		for (int state = 0; state < EntityQuery::STATE_COUNT; state++)
+		{
+			filter.state = state;
+			states += "  " + std::string(EntityQuery::getStateName(state)) + " " + std::to_string(census->count(filter));
+		}
+
+		printConsole(kinds);
+		printConsole(states);
+	}
+
+	void profile(const std::string& action)
+	{
+		if (!Profiler::isCompiledIn())
+			reportConsoleError("profile: not compiled in, rebuild with DAYW_PROFILE defined");
+
+		else if (action == "on" || action == "off")
+			Profiler::setEnabled(action == "on");
+
+		else if (action == "reset")
+			Profiler::reset();
+
+		else if (action == "report")
+		{
+			std::vector<std::string> lines;
+			Profiler::report(lines);
+
+			for (std::string& line : lines)
+				printConsole(line);
+		}
+
+		else
+			reportConsoleError("profile: expected on, off, reset or report");
+	}
+
+	void printAllocations(const std::string& action)
+	{
+		if (!AllocationTracker::isCompiledIn())
+			reportConsoleError("allocations: not compiled in, rebuild with DAYW_TRACK_ALLOCATIONS defined");
+
+		else if (action == "reset")
+		{
+			AllocationTracker::resetThread();
+			AllocationTracker::resetTagPeaks();
+			allocationTicks.reset();
+		}
+
+		else if (action.empty())
+		{
+			std::vector<std::string> lines;
+			Profiler::reportAllocations(allocationTicks, lines);
+
+			for (std::string& line : lines)
+				printConsole(line);
+		}
+
+		else
+			reportConsoleError("allocations: expected no argument or reset");
+	}
+
+	void printPerf(const std::string& action)
+	{
+		if (action == "on" || action == "off")
+		{
+			view->setPerfShown(action == "on");
+			perf.setPhasesTimed(action == "on");
+		}
+
+		else if (action == "reset")
+			perf.reset();
+
+		else if (action.empty())
+		{
+			std::vector<std::string> lines;
+			perf.report(lines);
+
+			for (std::string& line : lines)
+				printConsole(line);
+		}
+
+		else
+			reportConsoleError("perf: expected no argument, on, off or reset");
+	}
+
+	// Kinds without a sex suffix match both sexes and spawn a random one
+	static bool isKindName(const std::string& kind)
+	{
+		static const char* names[] = { "food", "plant", "planteating", "planteatingmale", "planteatingfemale", "predator", "predatormale", "predatorfemale" };
+
+		for (const char* name : names)
+			if (kind == name)
+				return true;
+
+		return false;
+	}
+
+	static bool isOfKind(Entity* entity, const std::string& kind)
+	{
+		if (kind.empty())
+			return true;
+
+		if (kind == "food")
+			return entity->isFood();
+
+		if (kind == "plant")
+			return entity->isPlant();
+
+		bool isPredator = kind.compare(0, 8, "predator") == 0;
+
+		if (!entity->isAnimal() || entity->isPredator() != isPredator)
+			return false;
+
+		std::string sex = kind.substr(isPredator ? 8 : 11);
+
+		return sex.empty() || entity->isMale() == (sex == "male");
+	}
+
+	void spawnEntity(const std::string& kind, Position pos)
+	{
+		if (kind == "food")
+			model->addFood(pos);
+		else if (kind == "plant")
+			model->addPlant(pos);
+		else
+		{
+			bool isPredator = kind.compare(0, 8, "predator") == 0;
+			std::string sex = kind.substr(isPredator ? 8 : 11);
+			bool isMale = sex.empty() ? MathUtility::randomInt(model->getRandom(), 0, 1) == 1 : sex == "male";
+
+			if (isPredator)
+				isMale ? model->addPredatorMale(pos) : model->addPredatorFemale(pos);
+			else
+				isMale ? model->addPlantEatingMale(pos) : model->addPlantEatingFemale(pos);
+		}
+	}
+
+	bool checkKind(std::string command, const std::string& kind)
+	{
+		if (kind.empty() || isKindName(kind))
+			return true;
+
+		reportConsoleError(command + ": unknown kind '" + kind + "'");
+		return false;
+	}
+
+	// Region commands walk only the clipped bounding box and test occupancy against the block counts
+	void fillRegion(const std::string& kind, Region region, int density)
+	{
+		if (!checkKind("fill", kind))
+			return;
+
+		region.clip(model->getMap()->getHeight(), model->getMap()->getWidth());
+
+		for (int y = region.bottom; y <= region.top; y++)
+			for (int x = region.left; x <= region.right; x++)
+			{
+				Position pos(x, y);
+
+				if (region.contains(x, y) && model->isFree(pos) && MathUtility::randomInt(model->getRandom(), 1, 100) <= density)
+					spawnEntity(kind, pos);
+			}
+	}
+
+	void scatterRegion(const std::string& kind, int count, Region region)
+	{
+		if (!checkKind("scatter", kind))
+			return;
+
+		region.clip(model->getMap()->getHeight(), model->getMap()->getWidth());
+
+		std::vector<Position> freeCells;
+
+		for (int y = region.bottom; y <= region.top; y++)
+			for (int x = region.left; x <= region.right; x++)
+			{
+				Position pos(x, y);
+
+				if (region.contains(x, y) && model->isFree(pos))
+					freeCells.push_back(pos);
+			}
+
+		count = std::min(count, (int)freeCells.size());
+
+		for (int i = 0; i < count; i++)
+		{
+			int chosen = MathUtility::randomInt(model->getRandom(), i, (int)freeCells.size() - 1);
+			std::swap(freeCells[i], freeCells[chosen]);
+
+			spawnEntity(kind, freeCells[i]);
+		}
+	}
+
+	void clearRegion(Region region, const std::string& kind)
+	{
+		if (!checkKind("clear", kind))
+			return;
+
+		region.clip(model->getMap()->getHeight(), model->getMap()->getWidth());
+
+		if (region.isEmpty())
+			return;
+
+		std::vector<Entity*> found;
+		model->getInRegion(region, found);
+
+		std::unordered_set<Entity*> victims;
+
+		for (Entity* entity : found)
+			if (isOfKind(entity, kind))
+				victims.insert(entity);
+
+		model->removeEntities(victims);
+	}
+
+	// Runs on the simulation thread, so nested scripts execute inline within the current batch
+	void executeScript(std::string path)
+	{
+		std::vector<std::string> ignored;
+		std::vector<std::string>& errors = consoleErrors ? *consoleErrors : ignored;
+
+		if (scriptDepth >= MAX_SCRIPT_DEPTH)
+		{
+			reportConsoleError(path + ": scripts nested too deeply");
+			return;
+		}
+
+		std::ifstream file(path);
+
+		if (!file)
+		{
+			reportConsoleError(path + ": cannot open");
+			return;
+		}
+
+		std::vector<Console::Call> calls;
+		consoleHandlers.parseAll(file, path, calls, errors);
+
+		scriptDepth++;
+		executeCalls(calls);
+		scriptDepth--;
+	}
+
+	void executeCalls(const std::vector<Console::Call>& calls)
+	{
+		std::string outerLocation = consoleLocation;
+
+		Console::execute(calls, [this](const Console::Call& call) { consoleLocation = Console::getLocation(call.source, call.line); });
+		consoleLocation = outerLocation;
+	}
+
+	// Lines printed by query commands are appended to output when it is given
+	std::vector<std::string> runCommands(std::istream& in, std::string source, std::vector<std::string>* output = nullptr)
+	{
+		std::vector<Console::Call> calls;
+		std::vector<std::string> errors;
+
+		consoleHandlers.parseAll(in, source, calls, errors);
+
+		if (calls.empty())
+			return errors;
+
+		runOnSimulationThread([&]()
+			{
+				consoleErrors = &errors;
+				consoleOutput = output;
+				executeCalls(calls);
+				consoleErrors = nullptr;
+				consoleOutput = nullptr;
+			}
+		);
+
+		return errors;
+	}
+
+	std::vector<std::string> runScript(std::string path, std::vector<std::string>* output = nullptr)
+	{
+		if (path == "-")
+			return runCommands(std::cin, "stdin", output);
+
+		std::ifstream file(path);
+
+		if (!file)
+			return std::vector<std::string>(1, path + ": cannot open");
+
+		return runCommands(file, path, output);
+	}
+
+	void run()
+	{
+		publish();
+
+		Tracer::setThreadName("input");
+		stopping = false;
+		simulationThread = std::thread(&Controller::simulationLoop, this);
+		renderThread = std::thread(&Controller::renderLoop, this);
+
+		while (view->getState() != EXIT)
+			controlUponState();
+
+		{
+			std::lock_guard<std::mutex> lock(commandsMutex);
+			stopping = true;
+		}
+
+		commandsChanged.notify_all();
+		commandsApplied.notify_all();
+
+		simulationThread.join();
+		renderThread.join();
 	}
 
 	void controlUponState()
@@ -201,21 +935,30 @@ public:
 		if (view->getState() != CONSOLE)
 			KeyboardUtility::handleKeyboard();
 		view->nextState();
-		view->render();
 
-		ViewState previousViewState = view->getPreviousState();
 		ViewState viewState = view->getState();
 
-		if (viewState == OBSERVATION && previousViewState != CONTINUEMENU && previousViewState != STARTMENU
-			&& previousViewState != CONSOLE)
+		if (viewState == OBSERVATION && view->getPreviousState() == OBSERVATION)
 		{
-			nextStateOfModel();
+			if (KeyboardUtility::onP())
+				setAutoplay(!autoplayIsEnabled);
+
+			else if (KeyboardUtility::onF())
+				setMaxSpeed(!maxSpeedIsEnabled);
+
+			else if (KeyboardUtility::onPeriod() && !autoplayIsEnabled)
+				runOnSimulationThread([this]() { simulateTick(); });
 		}
 
-		else if (viewState == CONSOLE)
-		{
+		bool isRunning = viewState == OBSERVATION && autoplayIsEnabled;
+
+		if (simulationIsRunning.exchange(isRunning) != isRunning)
+			statusIsChanged = true;
+
+		commandsChanged.notify_all();
+
+		if (viewState == CONSOLE)
 			handleConsole();
-		}
 	}
 
 	void actOfPlant(Entity* entity)
@@ -255,6 +998,7 @@ public:
 				entity->setCallee(nullptr);
 			}
 
+			PROFILE_SCOPE(PHASE_TARGET_SEARCH);
 			Entity* possiblePair;
 
 			if (entity->isMale())
@@ -272,12 +1016,15 @@ public:
 		else if (state == SEARCHINGFOREAT)
 		{
 			if (entity->getTarget() == nullptr || entity->getTarget()->getState() == DIED)
+			{
+				PROFILE_SCOPE(PHASE_TARGET_SEARCH);
 				entity->setTarget(model->getClosest(
 					SetUtility::Intersection(
 						SetUtility::Intersection(model->getAlive(), model->getEatable()),
 						SetUtility::Union(model->getFood(), model->getPlants()))
 
 					, entity));
+			}
 
 			if (entity->getTarget())
 				moveToTarget(entity, entity->getTarget());
@@ -292,6 +1039,8 @@ public:
 		else if (state == SEARCHINGFORPAIR)
 		{
 			if (entity->getTarget() == nullptr || entity->getTarget()->getState() == DIED)
+			{
+				PROFILE_SCOPE(PHASE_TARGET_SEARCH);
 				entity->setTarget(
 					model->getClosest(
 						SetUtility::Intersection(
@@ -300,6 +1049,7 @@ public:
 									model->getAlive(), model->getReproducable()), model->getAnimals()), model->getPlantEating())
 
 						, entity));
+			}
 
 			moveToTarget(entity, entity->getTarget());
 		}
@@ -326,6 +1076,7 @@ public:
 				entity->setCallee(nullptr);
 			}
 
+			PROFILE_SCOPE(PHASE_TARGET_SEARCH);
 			Entity* possiblePair;
 
 			if (entity->isMale())
@@ -343,12 +1094,15 @@ public:
 		else if (state == SEARCHINGFOREAT)
 		{
 			if (entity->getTarget() == nullptr || entity->getTarget()->getState() == DIED)
+			{
+				PROFILE_SCOPE(PHASE_TARGET_SEARCH);
 				entity->setTarget(model->getClosest(
 					SetUtility::Intersection(
 						SetUtility::Intersection(model->getAlive(), model->getEatable()), 
 						SetUtility::Union(model->getFood(), model->getPlantEating()))
 
 					, entity));
+			}
 
 			if (entity->getTarget())
 				moveToTarget(entity, entity->getTarget());
@@ -363,6 +1117,8 @@ public:
 		else if (state == SEARCHINGFORPAIR)
 		{
 			if (entity->getTarget() == nullptr || entity->getTarget()->getState() == DIED)
+			{
+				PROFILE_SCOPE(PHASE_TARGET_SEARCH);
 				entity->setTarget(
 					model->getClosest(
 						SetUtility::Intersection(
@@ -371,6 +1127,7 @@ public:
 									model->getAlive(), model->getReproducable()), model->getAnimals()), model->getPredators())
 
 						, entity));
+			}
 
 			moveToTarget(entity, entity->getTarget());
 		}
@@ -383,6 +1140,8 @@ public:
 
 	void actUponState(Entity* entity)
 	{
+		PROFILE_SCOPE((ProfilePhase)(PHASE_ACT_IDLE + entity->getState()));
+
 		if (entity->isPlantEating())
 			actOfPlantEating(entity);
 
@@ -401,6 +1160,8 @@ public:
 
 	void makeActiveAllBorn()
 	{
+		PROFILE_SCOPE(PHASE_MAKE_ACTIVE_ALL_BORN);
+
 		std::set<Entity*> bornEntities = model->getInactive();
 
 		for (Entity* entity : bornEntities)
@@ -409,6 +1170,8 @@ public:
 
 	void nextStateOf(Entity* entity)
 	{
+		PROFILE_SCOPE(getNextStatePhase(entity));
+
 		if (entity->isAnimal())
 			nextStateOfAnimal(entity);
 
@@ -419,19 +1182,69 @@ public:
 			nextStateOfFood(entity);
 	}
 
+	static ProfilePhase getNextStatePhase(Entity* entity)
+	{
+		return entity->isAnimal() ? (entity->isPredator() ? PHASE_NEXT_STATE_PREDATOR : PHASE_NEXT_STATE_PLANT_EATING) :
+			entity->isPlant() ? PHASE_NEXT_STATE_PLANT : PHASE_NEXT_STATE_FOOD;
+	}
+
 	void nextStateOfModel()
 	{
+		PROFILE_SCOPE(PHASE_TICK);
+
+		if (AllocationTracker::isCompiledIn())
+			allocationTicks.begin();
+
+		perf.beginTick();
+		bool phasesAreTimed = perf.arePhasesTimed();
+
 		for (Entity* entity : model->getEntities())
 		{
 			if (!entity->isActive())
 				continue;
 
+			if (!phasesAreTimed)
+			{
+				nextStateOf(entity);
+				actUponState(entity);
+				continue;
+			}
+
 			nextStateOf(entity);
+			perf.mark(getNextStatePhase(entity));
+
+			ProfilePhase actPhase = (ProfilePhase)(PHASE_ACT_IDLE + entity->getState());
 			actUponState(entity);
+			perf.mark(actPhase);
 		}
 
 		handleAllDied();
+
+		if (phasesAreTimed)
+			perf.mark(PHASE_HANDLE_ALL_DIED);
+
 		makeActiveAllBorn();
+
+		if (phasesAreTimed)
+			perf.mark(PHASE_MAKE_ACTIVE_ALL_BORN);
+
+		// Tick listeners such as recorders are attachments, so they stay out of the per-tick allocation figures
+		if (AllocationTracker::isCompiledIn())
+			allocationTicks.end();
+
+		if (Tracer::isCompiledIn() && Tracer::isEnabled())
+		{
+			PopulationStats* population = model->getPopulation();
+
+			Tracer::counter("planteating", population->getKindCount(BlockCounts::PLANT_EATING));
+			Tracer::counter("predator", population->getKindCount(BlockCounts::PREDATOR));
+			Tracer::counter("plant", population->getKindCount(BlockCounts::PLANT));
+			Tracer::counter("food", population->getKindCount(BlockCounts::FOOD));
+		}
+
+		model->nextTick();
+
+		perf.endTick(model, AllocationTracker::isCompiledIn() ? (long long)allocationTicks.lastAllocations : -1);
 	}
 
 	void nextStateOfAnimal(Entity* entity)
@@ -555,7 +1368,7 @@ public:
 			}
 		}
 
-		entity->setState(state);
+		model->changeState(entity, state);
 	}
 
 	void nextStateOfPlant(Entity* entity)
@@ -594,7 +1407,7 @@ public:
 			}
 		}
 
-		entity->setState(state);
+		model->changeState(entity, state);
 	}
 
 	void nextStateOfFood(Entity* entity)
@@ -617,70 +1430,48 @@ public:
 			}
 		}
 
-		entity->setState(state);
+		model->changeState(entity, state);
 	}
 
 	void handleAllDied()
 	{
-		Entity* toDelete = nullptr;
-		for (Entity* entity : model->getEntities())
-		{
-			if (toDelete)
-			{
-				for (Entity* enity : model->getEntities())
-					handleDied(toDelete);
+		PROFILE_SCOPE(PHASE_HANDLE_ALL_DIED);
 
-				model->getEntities().erase(toDelete);
-				toDelete = nullptr;
-			}
+		diedEntities.clear();
 
+		for (Entity* entity : model->getEntities())
 			if (entity->getState() == DIED)
-				toDelete = entity;
-		}
+				diedEntities.insert(entity);
 
-		if (toDelete)
-		{
-			handleDied(toDelete);
-			model->getEntities().erase(toDelete);
-		}
-	}
-
-	void handleDied(Entity* entity)
-	{
-		for (Entity* another : model->getEntities())
-		{
-			if (another->getTarget() == entity)
-				another->setTarget(nullptr);
+		// One pass frees the dead and clears survivors' references to them
+		int removed = model->removeEntities(diedEntities);
 
-			if (another->getCallee() == entity)
-				another->setCallee(nullptr);
-		}
+		for (int i = 0; i < removed; i++)
+			model->getPopulation()->countDeath();
 	}
 
 	void handleConsole()
 	{
-		std::string command;
-		std::getline(std::cin, command);
+		PROFILE_SCOPE(PHASE_HANDLE_CONSOLE);
 
-		if (command.empty() || command == "\n")
-			return;
-
-		std::stringstream commandTokens = std::stringstream(command);
-		std::vector<std::string> tokens;
-
-		std::string token;
-		while (std::getline(commandTokens, token, ' '))
-			tokens.push_back(token);
+		std::string command;
 
-		command = tokens[0];
+		KeyboardUtility::disableRawMode();
+		bool isRead = (bool)std::getline(std::cin, command);
+		KeyboardUtility::enableRawMode();
 
-		int argumentCount = tokens.size() - 1;
+		if (!isRead)
+		{
+			KeyboardUtility::markInputClosed();
+			return;
+		}
 
-		if (argumentCount == 2)
-			consoleHandlers.applyCommandByName(command, std::stoi(tokens[1]), std::stoi(tokens[2]));
+		std::istringstream line(command);
+		std::vector<std::string> output;
+		std::vector<std::string> errors = runCommands(line, "console", &output);
 
-		else if (argumentCount == 0)
-			consoleHandlers.applyCommandByName(command);
+		view->setConsoleMessages(errors.empty() ? output : errors);
+		view->redrawConsole();
 	}
 
 	void increaseHealth(Entity* eating, int healthAddition)
@@ -692,7 +1483,7 @@ public:
 		if (health > eating->getMaxHealth())
 			health = eating->getMaxHealth();
 
-		eating->setHealth(health);
+		model->changeHealth(eating, health);
 	}
 
 	void decreaseHealth(Entity* eating, int healthDecreasion)
@@ -704,7 +1495,7 @@ public:
 		if (health < 0)
 			health = 0;
 
-		eating->setHealth(health);
+		model->changeHealth(eating, health);
 	}
 
 	void increaseHunger(Entity* eating, int hungerDecreasion)
@@ -716,7 +1507,7 @@ public:
 		if (hunger > eating->getMaxHunger())
 			hunger = eating->getMaxHunger();
 
-		eating->setHunger(hunger);
+		model->changeHunger(eating, hunger);
 	}
 
 	void decreaseHunger(Entity* eating, int hungerDecreasion)
@@ -728,7 +1519,7 @@ public:
 		if (hunger < 0)
 			hunger = 0;
 
-		eating->setHunger(hunger);
+		model->changeHunger(eating, hunger);
 	}
 
 	void increaseOld(Entity* eating, int oldIncreasion)
@@ -740,24 +1531,28 @@ public:
 		if (old > eating->getMaxOld())
 			old = eating->getMaxOld();
 
-		eating->setOld(old);
+		model->changeOld(eating, old);
 	}
 
 	void randomlyWalk(Entity* entity)
 	{
+		PROFILE_SCOPE(PHASE_MOVEMENT);
+
 		std::set<Position> freeAdjacentPositions = model->getFreeAdjacent(entity->getPosition());
 
 		if (!freeAdjacentPositions.empty())
 		{
-			Position pos = SetUtility::randomFrom(freeAdjacentPositions);
+			Position pos = SetUtility::randomFrom(freeAdjacentPositions, model->getRandom());
 
-			entity->setPosition(pos);
+			model->moveEntity(entity, pos);
 			//moveTo(entity, pos);
 		}
 	}
 
 	void moveToTarget(Entity* entity, Entity* target)
 	{
+		PROFILE_SCOPE(PHASE_MOVEMENT);
+
 		std::set<Position> freeAdjacent = model->getFreeAdjacent(entity->getPosition());
 
 
@@ -769,12 +1564,14 @@ public:
 				if (heuristicFunctionForShortest(pos, target->getPosition()) < heuristicFunctionForShortest(min, target->getPosition()))
 					min = pos;
 
-			entity->setPosition(min);
+			model->moveEntity(entity, min);
 		}
 	}
 
 	void moveToSafePlace(Entity* entity)
 	{
+		PROFILE_SCOPE(PHASE_MOVEMENT);
+
 		Position pos = model->getClosest(model->getSafePlaces(), entity->getPosition());
 
 		if (pos != Position(-1, -1))
@@ -789,7 +1586,7 @@ public:
 					if (heuristicFunctionForShortest(position, pos) < heuristicFunctionForShortest(min, pos))
 						min = position;
 
-				entity->setPosition(min);
+				model->moveEntity(entity, min);
 			}
 		}
 	}
@@ -820,18 +1617,20 @@ public:
 
 	void reproduceByPlantEating(Entity* one, Entity* another)
 	{
+		PROFILE_SCOPE(PHASE_BIRTHS);
+
 		std::set<Position> freePositions = model->getFreeAdjacent(one->getPosition());
 
 		if (freePositions.empty())
 			return;
 
-		int randomNumber = MathUtility::randomInt(1, 4);
+		int randomNumber = MathUtility::randomInt(model->getRandom(), 1, 4);
 
 		if (randomNumber == 1)
 		{
-			Position pos = SetUtility::randomFrom(freePositions);
+			Position pos = SetUtility::randomFrom(freePositions, model->getRandom());
 
-			int whetherMale = MathUtility::randomInt(0, 1);
+			int whetherMale = MathUtility::randomInt(model->getRandom(), 0, 1);
 
 			if (whetherMale)
 				model->bornNewPlantEatingMale(pos);
@@ -850,6 +1649,7 @@ public:
 		{
 			healthAddition = 6;
 			hungerDecreasion = 5;
+			model->getPopulation()->countPredation();
 		}
 
 		else if (eatable->isFood())
@@ -867,18 +1667,20 @@ public:
 
 	void reproduceByPredator(Entity* one, Entity* another)
 	{
+		PROFILE_SCOPE(PHASE_BIRTHS);
+
 		std::set<Position> freePositions = model->getFreeAdjacent(one->getPosition());
 
 		if (freePositions.empty())
 			return;
 
-		Position pos = SetUtility::randomFrom(freePositions);
+		Position pos = SetUtility::randomFrom(freePositions, model->getRandom());
 
-		int randomNumber = MathUtility::randomInt(1, 8);
+		int randomNumber = MathUtility::randomInt(model->getRandom(), 1, 8);
 
 		if (randomNumber == 1)
 		{
-			int whetherMale = MathUtility::randomInt(0, 1);
+			int whetherMale = MathUtility::randomInt(model->getRandom(), 0, 1);
 
 			if (whetherMale)
 				model->bornNewPredatorMale(pos);
@@ -890,14 +1692,16 @@ public:
 
 	void reproduceByPlant(Entity* one)
 	{
+		PROFILE_SCOPE(PHASE_BIRTHS);
+
 		std::set<Position> freePositions = model->getFreeAdjacent(one->getPosition());
 
 		if (freePositions.empty())
 			return;
 
-		Position pos = SetUtility::randomFrom(freePositions);
+		Position pos = SetUtility::randomFrom(freePositions, model->getRandom());
 
-		int randomNumber = MathUtility::randomInt(1, 8);
+		int randomNumber = MathUtility::randomInt(model->getRandom(), 1, 8);
 
 		if (randomNumber == 1)
 		{
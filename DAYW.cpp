@@ -1,35 +1,738 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
 #include "KeyboardUtility.h"
 #include "Model.h"
 #include "View.h"
 #include "Controller.h"
+#include "TrajectoryRecorder.h"
+#include "Checkpointer.h"
+#include "DeltaJournal.h"
+#include "MappedSnapshot.h"
+#include "FrameExporter.h"
+#include "PopulationSeries.h"
+#include "Benchmark.h"
+#include "ScalingHarness.h"
+#include "DeterminismChecker.h"
 
 class SimulationApp
 {
 public:
 	SimulationApp() {}
 
-	static void runSimulation()
+	static void runSimulation(std::vector<std::string> args)
 	{
+		double tickRate = 10;
+		double frameRate = 30;
+		int height = 20;
+		int width = 20;
+		bool maxSpeed = false;
+		bool perfIsShown = false;
+		std::string scriptPath;
+		std::string tracePath;
+		bool traceIsFine = false;
+		long long traceMaxEvents = 0;
+
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			bool hasValue = i + 1 < args.size();
+
+			if (args[i] == "--max-speed")
+				maxSpeed = true;
+
+			else if (args[i] == "--perf")
+				perfIsShown = true;
+
+			else if (args[i] == "--tick-rate" && hasValue)
+				tickRate = std::atof(args[++i].c_str());
+
+			else if (args[i] == "--fps" && hasValue)
+				frameRate = std::atof(args[++i].c_str());
+
+			else if (args[i] == "--script" && hasValue)
+				scriptPath = args[++i];
+
+			else if (args[i] == "--size" && i + 2 < args.size())
+			{
+				height = std::atoi(args[++i].c_str());
+				width = std::atoi(args[++i].c_str());
+			}
+
+			else if (args[i] == "--trace" && hasValue)
+				tracePath = args[++i];
+
+			else if (args[i] == "--trace-detail" && hasValue)
+				traceIsFine = args[++i] == "fine";
+
+			else if (args[i] == "--trace-max-events" && hasValue)
+				traceMaxEvents = std::strtoll(args[++i].c_str(), nullptr, 10);
+		}
+
 		KeyboardUtility::init(100);
 
-		Model model(20, 20);
+		Model model(height, width);
 		View view(&model);
 		view.initMenues();
 
 		Controller controller(&model, &view);
+		controller.setTickRate(tickRate);
+		controller.setFrameRate(frameRate);
+		controller.setMaxSpeed(maxSpeed);
+		view.setPerfShown(perfIsShown);
+		controller.getPerf()->setPhasesTimed(perfIsShown);
+
+		if (!scriptPath.empty())
+		{
+			std::vector<std::string> output;
+			std::vector<std::string> errors = controller.runScript(scriptPath, &output);
+
+			reportOutput(output);
+			reportErrors(errors);
+		}
+
+		startTrace(tracePath, traceIsFine, traceMaxEvents);
+		controller.run();
+		finishTrace(tracePath);
+	}
+
+	static void startTrace(const std::string& path, bool isFine, long long maxEvents)
+	{
+		if (path.empty())
+			return;
+
+		if (!Tracer::isCompiledIn())
+			std::cerr << "tracer not compiled in, rebuild with DAYW_TRACE defined\n";
+
+		Tracer::setDetail(isFine ? Tracer::FINE : Tracer::COARSE);
+
+		if (maxEvents > 0)
+			Tracer::setMaxEventsPerThread(maxEvents);
+
+		Tracer::setEnabled(true);
+	}
+
+	// Called once every traced thread has stopped, so the merge sees complete buffers
+	static void finishTrace(const std::string& path)
+	{
+		if (path.empty() || !Tracer::isCompiledIn())
+			return;
+
+		Tracer::setEnabled(false);
+
+		if (!Tracer::write(path))
+		{
+			std::cerr << path << ": cannot write trace\n";
+			return;
+		}
+
+		std::cout << "trace events " << Tracer::getEventCount() << "\n"
+			<< "trace dropped " << Tracer::getDroppedCount() << "\n";
+	}
+
+	static void reportOutput(std::vector<std::string> output)
+	{
+		for (std::string& line : output)
+			std::cout << line << "\n";
+	}
+
+	static void reportErrors(std::vector<std::string> errors)
+	{
+		for (std::string& error : errors)
+			std::cerr << error << "\n";
+	}
+
+	static void runHeadless(std::vector<std::string> args)
+	{
+		long long ticks = 1000;
+		int height = 20;
+		int width = 20;
+		unsigned long long seed = RandomEngine()();
+		std::string recordPath;
+		std::string scriptPath;
+		std::string checkpointPath;
+		long long checkpointTicks = 0;
+		double checkpointSeconds = 0;
+		std::string journalPath;
+		int journalKeyframes = 100;
+		std::string fromJournalPath;
+		long long fromTick = -1;
+		std::string fromMappedPath;
+		std::string saveMappedPath;
+		std::string framesPrefix;
+		FrameExporter::Format framesFormat = FrameExporter::PPM;
+		long long framesEvery = 1;
+		int framesScale = 1;
+		bool framesDanger = false;
+		bool isProfiled = false;
+		bool areAllocationsTracked = false;
+		bool isPerfReported = false;
+		std::string seriesPath;
+		PopulationSeries::Format seriesFormat = PopulationSeries::CSV;
+		long long seriesEvery = 1;
+		std::string tracePath;
+		bool traceIsFine = false;
+		long long traceMaxEvents = 0;
+
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			bool hasValue = i + 1 < args.size();
+
+			if (args[i] == "--ticks" && hasValue)
+				ticks = std::strtoll(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--size" && i + 2 < args.size())
+			{
+				height = std::atoi(args[++i].c_str());
+				width = std::atoi(args[++i].c_str());
+			}
+
+			else if (args[i] == "--seed" && hasValue)
+				seed = std::strtoull(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--record" && hasValue)
+				recordPath = args[++i];
+
+			else if (args[i] == "--script" && hasValue)
+				scriptPath = args[++i];
+
+			else if (args[i] == "--checkpoint" && hasValue)
+				checkpointPath = args[++i];
+
+			else if (args[i] == "--checkpoint-every" && hasValue)
+				checkpointTicks = std::strtoll(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--checkpoint-seconds" && hasValue)
+				checkpointSeconds = std::atof(args[++i].c_str());
+
+			else if (args[i] == "--journal" && hasValue)
+				journalPath = args[++i];
+
+			else if (args[i] == "--journal-keyframes" && hasValue)
+				journalKeyframes = std::atoi(args[++i].c_str());
+
+			else if (args[i] == "--from-journal" && hasValue)
+				fromJournalPath = args[++i];
+
+			else if (args[i] == "--from-tick" && hasValue)
+				fromTick = std::strtoll(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--from-mapped" && hasValue)
+				fromMappedPath = args[++i];
+
+			else if (args[i] == "--save-mapped" && hasValue)
+				saveMappedPath = args[++i];
+
+			else if (args[i] == "--frames" && hasValue)
+				framesPrefix = args[++i];
+
+			else if (args[i] == "--frames-format" && hasValue)
+				framesFormat = args[++i] == "png" ? FrameExporter::PNG : FrameExporter::PPM;
+
+			else if (args[i] == "--frames-every" && hasValue)
+				framesEvery = std::strtoll(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--frames-scale" && hasValue)
+				framesScale = std::atoi(args[++i].c_str());
+
+			else if (args[i] == "--frames-danger")
+				framesDanger = true;
+
+			else if (args[i] == "--profile")
+				isProfiled = true;
+
+			else if (args[i] == "--allocations")
+				areAllocationsTracked = true;
+
+			else if (args[i] == "--perf")
+				isPerfReported = true;
+
+			else if (args[i] == "--series" && hasValue)
+				seriesPath = args[++i];
+
+			else if (args[i] == "--series-format" && hasValue)
+				seriesFormat = args[++i] == "bin" ? PopulationSeries::BINARY : PopulationSeries::CSV;
+
+			else if (args[i] == "--series-every" && hasValue)
+				seriesEvery = std::strtoll(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--trace" && hasValue)
+				tracePath = args[++i];
+
+			else if (args[i] == "--trace-detail" && hasValue)
+				traceIsFine = args[++i] == "fine";
+
+			else if (args[i] == "--trace-max-events" && hasValue)
+				traceMaxEvents = std::strtoll(args[++i].c_str(), nullptr, 10);
+		}
+
+		if (isProfiled && !Profiler::isCompiledIn())
+			std::cerr << "profiler not compiled in, rebuild with DAYW_PROFILE defined\n";
+
+		Profiler::setEnabled(isProfiled);
+
+		if (areAllocationsTracked && !AllocationTracker::isCompiledIn())
+			std::cerr << "allocation tracking not compiled in, rebuild with DAYW_TRACK_ALLOCATIONS defined\n";
+
+		Tracer::setThreadName("simulation");
+		startTrace(tracePath, traceIsFine, traceMaxEvents);
+
+		Model model(height, width, seed);
+		View view(&model);
+		Controller controller(&model, &view);
+		controller.getPerf()->setPhasesTimed(isPerfReported);
+
+		if (!fromJournalPath.empty())
+		{
+			DeltaJournalReader reader;
+
+			if (!reader.open(fromJournalPath) || !reader.seek(fromTick >= 0 ? fromTick : reader.getLastTick(), &model))
+			{
+				std::cerr << fromJournalPath << ": cannot restore from journal\n";
+				return;
+			}
+		}
+
+		if (!fromMappedPath.empty())
+		{
+			MappedSnapshot snapshot(fromMappedPath);
+
+			if (!snapshot.loadInto(&model))
+			{
+				std::cerr << fromMappedPath << ": cannot load mapped snapshot\n";
+				return;
+			}
+		}
+
+		if (!scriptPath.empty())
+		{
+			std::vector<std::string> output;
+
+			std::vector<std::string> errors = controller.runScript(scriptPath, &output);
+
+			reportOutput(output);
+			reportErrors(errors);
+		}
+
+		std::unique_ptr<TrajectoryRecorder> recorder;
+
+		if (!recordPath.empty())
+		{
+			recorder.reset(new TrajectoryRecorder(recordPath));
+			recorder->attach(&model);
+		}
+
+		std::unique_ptr<DeltaJournal> journal;
+
+		if (!journalPath.empty())
+		{
+			journal.reset(new DeltaJournal(journalPath, journalKeyframes));
+			journal->attach(&model);
+		}
+
+		std::unique_ptr<Checkpointer> checkpointer;
+
+		if (!checkpointPath.empty())
+		{
+			if (checkpointTicks <= 0 && checkpointSeconds <= 0)
+				checkpointTicks = 100;
+
+			checkpointer.reset(new Checkpointer(checkpointPath, checkpointTicks, checkpointSeconds));
+			checkpointer->attach(&model);
+		}
+
+		std::unique_ptr<FrameExporter> exporter;
+
+		if (!framesPrefix.empty())
+		{
+			exporter.reset(new FrameExporter(framesPrefix, framesFormat, framesEvery, framesScale, framesDanger));
+			exporter->attach(&model);
+		}
+
+		std::unique_ptr<PopulationSeries> series;
+
+		if (!seriesPath.empty())
+		{
+			series.reset(new PopulationSeries(seriesPath, seriesFormat, seriesEvery));
+			series->attach(&model);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (long long i = 0; i < ticks; i++)
+			controller.nextStateOfModel();
+
+		if (recorder)
+			recorder->close();
 
-		while (true)
+		if (journal)
+			journal->close();
+
+		if (checkpointer)
+		{
+			checkpointer->checkpoint(&model);
+			checkpointer->close();
+		}
+
+		if (exporter)
+			exporter->close();
+
+		if (series)
+			series->close();
+
+		if (!saveMappedPath.empty() && !MappedSnapshot::save(&model, saveMappedPath))
+			std::cerr << saveMappedPath << ": cannot write\n";
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "seed " << seed << "\n"
+			<< "ticks " << model.getTick() << "\n"
+			<< "entities " << model.getEntities().size() << "\n"
+			<< "seconds " << seconds << "\n"
+			<< "ticks/sec " << (seconds > 0 ? model.getTick() / seconds : 0) << "\n";
+
+		if (exporter)
+			std::cout << "frames " << exporter->getWrittenCount() << "\n"
+				<< "frame stalls " << exporter->getStallCount() << "\n";
+
+		if (series)
+			std::cout << "series rows " << series->getRowCount() << "\n";
+
+		if (journal)
+			std::cout << "journal frames " << journal->getFrameCount() << "\n"
+				<< "journal bytes " << journal->getSize() << "\n";
+
+		if (isPerfReported)
+		{
+			std::vector<std::string> lines;
+			controller.getPerf()->report(lines);
+			reportOutput(lines);
+		}
+
+		finishTrace(tracePath);
+
+		if (isProfiled && Profiler::isCompiledIn())
+			Profiler::report(std::cout);
+
+		if (areAllocationsTracked && AllocationTracker::isCompiledIn())
 		{
-			controller.nextStep();
+			std::vector<std::string> lines;
+			Profiler::reportAllocations(controller.getAllocationTicks(), lines);
+			reportOutput(lines);
 		}
 	}
+	static void runBenchmark(std::vector<std::string> args)
+	{
+		unsigned long long seed = 1;
+		std::string outPath;
+		std::vector<int> sizes;
+		std::vector<double> densities;
+		double caseSeconds = 0;
+		double maxIterationSeconds = 0;
+
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			bool hasValue = i + 1 < args.size();
+
+			if (args[i] == "--seed" && hasValue)
+				seed = std::strtoull(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--bench-sizes" && hasValue)
+				sizes = parseList<int>(args[++i]);
+
+			else if (args[i] == "--bench-densities" && hasValue)
+				densities = parseList<double>(args[++i]);
+
+			else if (args[i] == "--bench-seconds" && hasValue)
+				caseSeconds = std::atof(args[++i].c_str());
+
+			else if (args[i] == "--bench-max-seconds" && hasValue)
+				maxIterationSeconds = std::atof(args[++i].c_str());
+
+			else if (args[i] == "--bench-out" && hasValue)
+				outPath = args[++i];
+		}
+
+		Benchmark benchmark(seed);
+
+		if (!sizes.empty())
+			benchmark.setSizes(sizes);
+
+		if (!densities.empty())
+			benchmark.setDensities(densities);
+
+		if (caseSeconds > 0)
+			benchmark.setCaseSeconds(caseSeconds);
+
+		if (maxIterationSeconds > 0)
+			benchmark.setMaxIterationSeconds(maxIterationSeconds);
+
+		benchmark.run([](const BenchmarkResult& result)
+			{
+				std::cerr << result.name << " " << result.size << "x" << result.size << " density " << result.density << ": ";
+
+				if (result.skipped)
+					std::cerr << "skipped, predicted " << result.predictedSeconds << " s per iteration\n";
+				else
+					std::cerr << result.meanNanoseconds / 1000 << " us (" << result.iterations << " iterations)\n";
+			}
+		);
+
+		if (outPath.empty())
+		{
+			benchmark.writeJson(std::cout);
+			return;
+		}
+
+		std::ofstream out(outPath);
+		benchmark.writeJson(out);
+
+		if (!out)
+			std::cerr << outPath << ": cannot write\n";
+	}
+
+	// Returns non-zero when a fitted exponent regressed against the baseline
+	static int runScaling(std::vector<std::string> args)
+	{
+		unsigned long long seed = 1;
+		std::string outPath;
+		std::string baselinePath;
+		std::string saveBaselinePath;
+		std::vector<int> sizes;
+		std::vector<double> densities;
+		std::vector<PopulationMix> mixes;
+		std::vector<int> threadCounts;
+		double configurationSeconds = 0;
+		double tolerance = -1;
+
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			bool hasValue = i + 1 < args.size();
+
+			if (args[i] == "--seed" && hasValue)
+				seed = std::strtoull(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--scale-sizes" && hasValue)
+				sizes = parseList<int>(args[++i]);
+
+			else if (args[i] == "--scale-densities" && hasValue)
+				densities = parseList<double>(args[++i]);
+
+			else if (args[i] == "--scale-mixes" && hasValue)
+			{
+				for (std::string& text : parseList<std::string>(args[++i]))
+				{
+					PopulationMix mix;
+
+					if (mix.parse(text))
+						mixes.push_back(mix);
+					else
+						std::cerr << "ignoring mix '" << text << "', expected planteating:predator:plant:food\n";
+				}
+			}
+
+			else if (args[i] == "--scale-threads" && hasValue)
+				threadCounts = parseList<int>(args[++i]);
+
+			else if (args[i] == "--scale-seconds" && hasValue)
+				configurationSeconds = std::atof(args[++i].c_str());
+
+			else if (args[i] == "--scale-tolerance" && hasValue)
+				tolerance = std::atof(args[++i].c_str());
+
+			else if (args[i] == "--scale-baseline" && hasValue)
+				baselinePath = args[++i];
+
+			else if (args[i] == "--scale-save-baseline" && hasValue)
+				saveBaselinePath = args[++i];
+
+			else if (args[i] == "--scale-out" && hasValue)
+				outPath = args[++i];
+		}
+
+		ScalingHarness harness(seed);
+
+		if (!sizes.empty())
+			harness.setSizes(sizes);
+
+		if (!densities.empty())
+			harness.setDensities(densities);
+
+		if (!mixes.empty())
+			harness.setMixes(mixes);
+
+		if (!threadCounts.empty())
+			harness.setThreadCounts(threadCounts);
+
+		if (configurationSeconds > 0)
+			harness.setConfigurationSeconds(configurationSeconds);
+
+		if (tolerance >= 0)
+			harness.setTolerance(tolerance);
+
+		harness.run([](const ScalingResult& result)
+			{
+				std::cerr << result.size << "x" << result.size << " density " << result.density << " mix " << result.mix.toString()
+					<< " threads " << result.threads << ": " << result.ticksPerSecond << " ticks/sec, " << result.meanEntities
+					<< " entities, p99 " << result.p99Microseconds << " us\n";
+			}
+		);
+
+		if (!baselinePath.empty() && !harness.compareWithBaseline(baselinePath))
+			std::cerr << baselinePath << ": cannot open\n";
+
+		for (const ScalingFit& fit : harness.getFits())
+		{
+			std::cerr << "fit density " << fit.density << " mix " << fit.mix.toString() << " threads " << fit.threads << ": exponent " << fit.exponent;
+
+			if (fit.hasBaseline)
+				std::cerr << " (baseline " << fit.baselineExponent << (fit.isRegressed ? ", REGRESSED)" : ")");
+
+			std::cerr << "\n";
+		}
+
+		if (!saveBaselinePath.empty() && !harness.saveBaseline(saveBaselinePath))
+			std::cerr << saveBaselinePath << ": cannot write\n";
+
+		if (outPath.empty())
+			harness.writeJson(std::cout);
+		else
+		{
+			std::ofstream out(outPath);
+			harness.writeJson(out);
+
+			if (!out)
+				std::cerr << outPath << ": cannot write\n";
+		}
+
+		return harness.hasRegression() ? 1 : 0;
+	}
+
+	static int runDeterminism(std::vector<std::string> args)
+	{
+		long long ticks = 200;
+		int height = 15;
+		int width = 15;
+		unsigned long long seed = 1;
+		int seedCount = 3;
+		long long rebuildEvery = 7;
+		std::vector<std::string> engineNames = { "fork", "snapshot" };
+		std::string dumpPrefix = "divergence";
+
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			bool hasValue = i + 1 < args.size();
+
+			if (args[i] == "--ticks" && hasValue)
+				ticks = std::strtoll(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--size" && i + 2 < args.size())
+			{
+				height = std::atoi(args[++i].c_str());
+				width = std::atoi(args[++i].c_str());
+			}
+
+			else if (args[i] == "--seed" && hasValue)
+				seed = std::strtoull(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--seeds" && hasValue)
+				seedCount = std::atoi(args[++i].c_str());
+
+			else if (args[i] == "--engines" && hasValue)
+				engineNames = parseList<std::string>(args[++i]);
+
+			else if (args[i] == "--rebuild-every" && hasValue)
+				rebuildEvery = std::strtoll(args[++i].c_str(), nullptr, 10);
+
+			else if (args[i] == "--dump" && hasValue)
+				dumpPrefix = args[++i];
+		}
+
+		DeterminismChecker checker;
+		checker.setDumpPrefix(dumpPrefix);
+
+		for (std::string& name : engineNames)
+		{
+			if (name == "fork")
+				checker.addEngine(DeterminismChecker::forkEngine(rebuildEvery));
+
+			else if (name == "snapshot")
+				checker.addEngine(DeterminismChecker::snapshotEngine(rebuildEvery));
+
+			else
+			{
+				std::cerr << "unknown engine '" << name << "', expected fork or snapshot\n";
+				return 2;
+			}
+		}
+
+		int divergedCount = 0;
+
+		for (int i = 0; i < seedCount; i++)
+		{
+			Model initial(height, width, seed + i);
+			DeterminismResult result = checker.run(&initial, seed + i, ticks);
+
+			if (!result.isDiverged)
+			{
+				std::cout << "seed " << result.seed << ": identical for " << result.ticks << " ticks, final hash "
+					<< std::hex << result.hash << std::dec << "\n";
+				continue;
+			}
+
+			divergedCount++;
+			std::cout << "seed " << result.seed << ": " << result.engine << " diverged at tick " << result.tick << ", " << result.difference << "\n";
+
+			for (std::string& path : result.dumps)
+				std::cout << "  dumped " << path << "\n";
+		}
+
+		return divergedCount ? 1 : 0;
+	}
+
+	template <typename T>
+	static std::vector<T> parseList(const std::string& text)
+	{
+		std::vector<T> values;
+		std::istringstream in(text);
+		std::string item;
+
+		while (std::getline(in, item, ','))
+		{
+			std::istringstream value(item);
+			T parsed;
+
+			if (value >> parsed)
+				values.push_back(parsed);
+		}
+
+		return values;
+	}
 };
 
-int main()
+int main(int argc, char** argv)
 {
 	SimulationApp app;
 
-	app.runSimulation();
+	std::vector<std::string> args(argv + 1, argv + argc);
+
+	if (!args.empty() && args[0] == "--headless")
+		app.runHeadless(args);
+
+	else if (!args.empty() && args[0] == "--bench")
+		app.runBenchmark(args);
+
+	else if (!args.empty() && args[0] == "--scale")
+		return app.runScaling(args);
+
+	else if (!args.empty() && args[0] == "--determinism")
+		return app.runDeterminism(args);
+
+	else
+		app.runSimulation(args);
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,636 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <set>
+#include <fstream>
+#include <algorithm>
+#include "BinaryUtility.h"
+#include "EntityRecord.h"
+#include "Model.h"
+#include "Tracer.h"
+
+// Header, then frames of a kind byte, varint tick, varint payload size and payload, then a keyframe index and trailer
+class DeltaJournalFormat
+{
+public:
+	static const unsigned int MAGIC = 0x4A594144;
+	static const unsigned int INDEX_MAGIC = 0x4B594144;
+	static const unsigned int VERSION = 1;
+
+	static const int HEADER_SIZE = 8;
+	static const int INDEX_ENTRY_SIZE = 16;
+	static const int TRAILER_SIZE = 20;
+
+	static const unsigned char DELTA_FRAME = 0;
+	static const unsigned char KEYFRAME = 1;
+
+	static const unsigned char MOVED = 1;
+	static const unsigned char OLD_CHANGED = 2;
+	static const unsigned char HEALTH_CHANGED = 4;
+	static const unsigned char HUNGER_CHANGED = 8;
+	static const unsigned char STATE_CHANGED = 16;
+	static const unsigned char TARGET_CHANGED = 32;
+	static const unsigned char CALLEE_CHANGED = 64;
+	static const unsigned char FLAGS_CHANGED = 128;
+
+	struct Keyframe
+	{
+		long long tick;
+		unsigned long long offset;
+	};
+
+	static bool byId(const EntityRecord& one, const EntityRecord& another)
+	{
+		return one.id < another.id;
+	}
+
+	static void writeFull(std::vector<unsigned char>& out, const EntityRecord& record)
+	{
+		BinaryUtility::writeVarint(out, BinaryUtility::zigzag(record.target));
+		BinaryUtility::writeVarint(out, BinaryUtility::zigzag(record.callee));
+		BinaryUtility::writeVarint(out, record.xPos);
+		BinaryUtility::writeVarint(out, record.yPos);
+		BinaryUtility::writeVarint(out, record.old);
+		BinaryUtility::writeVarint(out, record.health);
+		BinaryUtility::writeVarint(out, record.hunger);
+		out.push_back(record.state);
+		out.push_back(record.flags);
+	}
+
+	static EntityRecord readFull(int id, const unsigned char*& in, const unsigned char* end)
+	{
+		EntityRecord record;
+
+		record.id = id;
+		record.target = (int)BinaryUtility::unzigzag(BinaryUtility::readVarint(in, end));
+		record.callee = (int)BinaryUtility::unzigzag(BinaryUtility::readVarint(in, end));
+		record.xPos = (unsigned short)BinaryUtility::readVarint(in, end);
+		record.yPos = (unsigned short)BinaryUtility::readVarint(in, end);
+		record.old = (unsigned short)BinaryUtility::readVarint(in, end);
+		record.health = (unsigned short)BinaryUtility::readVarint(in, end);
+		record.hunger = (unsigned short)BinaryUtility::readVarint(in, end);
+		record.state = in < end ? *in++ : 0;
+		record.flags = in < end ? *in++ : 0;
+
+		return record;
+	}
+
+	static void writeChange(std::vector<unsigned char>& out, const EntityRecord& before, const EntityRecord& after, int idDelta)
+	{
+		unsigned char mask = 0;
+
+		if (before.xPos != after.xPos || before.yPos != after.yPos)
+			mask |= MOVED;
+
+		if (before.old != after.old)
+			mask |= OLD_CHANGED;
+
+		if (before.health != after.health)
+			mask |= HEALTH_CHANGED;
+
+		if (before.hunger != after.hunger)
+			mask |= HUNGER_CHANGED;
+
+		if (before.state != after.state)
+			mask |= STATE_CHANGED;
+
+		if (before.target != after.target)
+			mask |= TARGET_CHANGED;
+
+		if (before.callee != after.callee)
+			mask |= CALLEE_CHANGED;
+
+		if (before.flags != after.flags)
+			mask |= FLAGS_CHANGED;
+
+		if (!mask)
+			return;
+
+		BinaryUtility::writeVarint(out, idDelta);
+		out.push_back(mask);
+
+		if (mask & MOVED)
+		{
+			BinaryUtility::writeVarint(out, BinaryUtility::zigzag((long long)after.xPos - before.xPos));
+			BinaryUtility::writeVarint(out, BinaryUtility::zigzag((long long)after.yPos - before.yPos));
+		}
+
+		if (mask & OLD_CHANGED)
+			BinaryUtility::writeVarint(out, BinaryUtility::zigzag((long long)after.old - before.old));
+
+		if (mask & HEALTH_CHANGED)
+			BinaryUtility::writeVarint(out, BinaryUtility::zigzag((long long)after.health - before.health));
+
+		if (mask & HUNGER_CHANGED)
+			BinaryUtility::writeVarint(out, BinaryUtility::zigzag((long long)after.hunger - before.hunger));
+
+		if (mask & STATE_CHANGED)
+			out.push_back(after.state);
+
+		if (mask & TARGET_CHANGED)
+			BinaryUtility::writeVarint(out, BinaryUtility::zigzag(after.target));
+
+		if (mask & CALLEE_CHANGED)
+			BinaryUtility::writeVarint(out, BinaryUtility::zigzag(after.callee));
+
+		if (mask & FLAGS_CHANGED)
+			out.push_back(after.flags);
+	}
+
+	static void readChange(EntityRecord& record, const unsigned char*& in, const unsigned char* end)
+	{
+		unsigned char mask = in < end ? *in++ : 0;
+
+		if (mask & MOVED)
+		{
+			record.xPos = (unsigned short)(record.xPos + BinaryUtility::unzigzag(BinaryUtility::readVarint(in, end)));
+			record.yPos = (unsigned short)(record.yPos + BinaryUtility::unzigzag(BinaryUtility::readVarint(in, end)));
+		}
+
+		if (mask & OLD_CHANGED)
+			record.old = (unsigned short)(record.old + BinaryUtility::unzigzag(BinaryUtility::readVarint(in, end)));
+
+		if (mask & HEALTH_CHANGED)
+			record.health = (unsigned short)(record.health + BinaryUtility::unzigzag(BinaryUtility::readVarint(in, end)));
+
+		if (mask & HUNGER_CHANGED)
+			record.hunger = (unsigned short)(record.hunger + BinaryUtility::unzigzag(BinaryUtility::readVarint(in, end)));
+
+		if (mask & STATE_CHANGED)
+			record.state = in < end ? *in++ : record.state;
+
+		if (mask & TARGET_CHANGED)
+			record.target = (int)BinaryUtility::unzigzag(BinaryUtility::readVarint(in, end));
+
+		if (mask & CALLEE_CHANGED)
+			record.callee = (int)BinaryUtility::unzigzag(BinaryUtility::readVarint(in, end));
+
+		if (mask & FLAGS_CHANGED)
+			record.flags = in < end ? *in++ : record.flags;
+	}
+
+	static void applyDelta(std::vector<EntityRecord>& records, const unsigned char* in, const unsigned char* end,
+		int& lastId, unsigned long long& randomState)
+	{
+		lastId = (int)BinaryUtility::readVarint(in, end);
+		randomState = in + 8 <= end ? BinaryUtility::readU64(in) : randomState;
+		in += 8;
+
+		std::vector<EntityRecord> born((size_t)BinaryUtility::readVarint(in, end));
+		int id = 0;
+
+		for (EntityRecord& record : born)
+		{
+			id += (int)BinaryUtility::readVarint(in, end);
+			record = readFull(id, in, end);
+		}
+
+		std::vector<int> died((size_t)BinaryUtility::readVarint(in, end));
+		id = 0;
+
+		for (int& diedId : died)
+		{
+			id += (int)BinaryUtility::readVarint(in, end);
+			diedId = id;
+		}
+
+		size_t changeCount = (size_t)BinaryUtility::readVarint(in, end);
+		id = 0;
+
+		for (size_t i = 0; i < changeCount && in < end; i++)
+		{
+			EntityRecord key;
+			key.id = (id += (int)BinaryUtility::readVarint(in, end));
+
+			auto found = std::lower_bound(records.begin(), records.end(), key, byId);
+
+			if (found != records.end() && found->id == id)
+				readChange(*found, in, end);
+
+			else
+			{
+				EntityRecord ignored = key;
+				readChange(ignored, in, end);
+			}
+		}
+
+		records.erase(std::remove_if(records.begin(), records.end(), [&died](const EntityRecord& record)
+			{
+				return std::binary_search(died.begin(), died.end(), record.id);
+			}), records.end());
+
+		size_t middle = records.size();
+		records.insert(records.end(), born.begin(), born.end());
+		std::inplace_merge(records.begin(), records.begin() + middle, records.end(), byId);
+	}
+};
+
+class DeltaJournal
+{
+	std::ofstream file;
+	int keyframeInterval;
+	long long lastKeyframeTick;
+	long long lastTick;
+	unsigned long long written;
+	size_t frameCount;
+
+	std::vector<DeltaJournalFormat::Keyframe> keyframes;
+
+	std::vector<EntityRecord> previous;
+	std::vector<EntityRecord> current;
+	std::vector<unsigned char> births;
+	std::vector<unsigned char> deaths;
+	std::vector<unsigned char> changes;
+	std::vector<unsigned char> payload;
+	std::vector<unsigned char> frameHeader;
+
+	void writeFrame(unsigned char kind, long long tick, const std::vector<unsigned char>& frame)
+	{
+		frameHeader.clear();
+		frameHeader.push_back(kind);
+		BinaryUtility::writeVarint(frameHeader, (unsigned long long)tick);
+		BinaryUtility::writeVarint(frameHeader, frame.size());
+
+		file.write((const char*)frameHeader.data(), frameHeader.size());
+		file.write((const char*)frame.data(), frame.size());
+
+		written += frameHeader.size() + frame.size();
+		frameCount++;
+		lastTick = tick;
+	}
+
+	void writeKeyframe(Model* model)
+	{
+		DeltaJournalFormat::Keyframe keyframe;
+		keyframe.tick = model->getTick();
+		keyframe.offset = written;
+		keyframes.push_back(keyframe);
+
+		model->saveBinary(payload);
+		writeFrame(DeltaJournalFormat::KEYFRAME, model->getTick(), payload);
+
+		model->getRecords(previous);
+		lastKeyframeTick = model->getTick();
+	}
+
+	// Walks the id-ordered entity set against the previous tick's records, collecting this tick's records on the way
+	void writeDelta(Model* model)
+	{
+		births.clear();
+		deaths.clear();
+		changes.clear();
+		current.clear();
+
+		size_t birthCount = 0;
+		size_t deathCount = 0;
+		size_t changeCount = 0;
+
+		int lastBirth = 0;
+		int lastDeath = 0;
+		int lastChange = 0;
+
+		std::set<Entity*, EntityIdLess>& entities = model->getEntities();
+		auto entity = entities.begin();
+		size_t i = 0;
+
+		while (i < previous.size() || entity != entities.end())
+		{
+			if (entity == entities.end() || (i < previous.size() && previous[i].id < (*entity)->getId()))
+			{
+				BinaryUtility::writeVarint(deaths, previous[i].id - lastDeath);
+				lastDeath = previous[i].id;
+				deathCount++;
+				i++;
+				continue;
+			}
+
+			current.push_back(EntityRecord::fromEntity(*entity++));
+			const EntityRecord& record = current.back();
+
+			if (i == previous.size() || record.id < previous[i].id)
+			{
+				BinaryUtility::writeVarint(births, record.id - lastBirth);
+				DeltaJournalFormat::writeFull(births, record);
+				lastBirth = record.id;
+				birthCount++;
+			}
+
+			else
+			{
+				size_t before = changes.size();
+
+				DeltaJournalFormat::writeChange(changes, previous[i], record, record.id - lastChange);
+
+				if (changes.size() != before)
+				{
+					lastChange = record.id;
+					changeCount++;
+				}
+
+				i++;
+			}
+		}
+
+		payload.clear();
+
+		BinaryUtility::writeVarint(payload, (unsigned int)model->getLastId());
+		payload.resize(payload.size() + 8);
+		BinaryUtility::writeU64(payload.data() + payload.size() - 8, model->getRandom().getState());
+
+		BinaryUtility::writeVarint(payload, birthCount);
+		payload.insert(payload.end(), births.begin(), births.end());
+
+		BinaryUtility::writeVarint(payload, deathCount);
+		payload.insert(payload.end(), deaths.begin(), deaths.end());
+
+		BinaryUtility::writeVarint(payload, changeCount);
+		payload.insert(payload.end(), changes.begin(), changes.end());
+
+		writeFrame(DeltaJournalFormat::DELTA_FRAME, model->getTick(), payload);
+
+		previous.swap(current);
+	}
+
+public:
+	DeltaJournal(std::string path, int keyframeInterval = 100)
+		: keyframeInterval(keyframeInterval > 0 ? keyframeInterval : 1), lastKeyframeTick(0), lastTick(-1), written(0), frameCount(0)
+	{
+		file.open(path, std::ios::binary | std::ios::trunc);
+
+		unsigned char header[DeltaJournalFormat::HEADER_SIZE];
+		BinaryUtility::writeU32(header, DeltaJournalFormat::MAGIC);
+		BinaryUtility::writeU32(header + 4, DeltaJournalFormat::VERSION);
+
+		file.write((const char*)header, sizeof(header));
+		written = sizeof(header);
+	}
+
+	~DeltaJournal()
+	{
+		close();
+	}
+
+	bool isOpen() { return file.is_open(); }
+
+	void attach(Model* model)
+	{
+		record(model);
+
+		model->addTickListener([this](Model* m)
+			{
+				this->record(m);
+			}
+		);
+	}
+
+	void record(Model* model)
+	{
+		TRACE_SCOPE("journal frame");
+
+		if (!file.is_open())
+			return;
+
+		if (frameCount == 0 || model->getTick() - lastKeyframeTick >= keyframeInterval)
+			writeKeyframe(model);
+
+		else
+			writeDelta(model);
+	}
+
+	// Appends the keyframe index and trailer; a journal cut off before this is still read by scanning its frames
+	void close()
+	{
+		if (!file.is_open())
+			return;
+
+		std::vector<unsigned char> index(keyframes.size() * DeltaJournalFormat::INDEX_ENTRY_SIZE + DeltaJournalFormat::TRAILER_SIZE);
+		unsigned char* out = index.data();
+
+		for (DeltaJournalFormat::Keyframe& keyframe : keyframes)
+		{
+			BinaryUtility::writeU64(out, (unsigned long long)keyframe.tick);
+			BinaryUtility::writeU64(out + 8, keyframe.offset);
+			out += DeltaJournalFormat::INDEX_ENTRY_SIZE;
+		}
+
+		BinaryUtility::writeU64(out, keyframes.size());
+		BinaryUtility::writeU64(out + 8, (unsigned long long)lastTick);
+		BinaryUtility::writeU32(out + 16, DeltaJournalFormat::INDEX_MAGIC);
+
+		file.write((const char*)index.data(), index.size());
+		file.close();
+	}
+
+	size_t getFrameCount() { return frameCount; }
+	size_t getKeyframeCount() { return keyframes.size(); }
+	unsigned long long getSize() { return written; }
+};
+
+// Holds only the keyframe index in memory; seeking reads one keyframe and the deltas after it
+class DeltaJournalReader
+{
+	std::ifstream file;
+	std::vector<DeltaJournalFormat::Keyframe> keyframes;
+	unsigned long long framesEnd;
+	long long lastTick;
+	std::vector<unsigned char> payload;
+
+	bool readVarint(unsigned long long& value)
+	{
+		value = 0;
+
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			int byte = file.get();
+
+			if (byte == std::char_traits<char>::eof())
+				return false;
+
+			value |= (unsigned long long)(byte & 0x7F) << shift;
+
+			if (!(byte & 0x80))
+				return true;
+		}
+
+		return false;
+	}
+
+	bool readFrame(unsigned char& kind, long long& tick)
+	{
+		if ((unsigned long long)file.tellg() >= framesEnd)
+			return false;
+
+		int byte = file.get();
+		unsigned long long frameTick;
+		unsigned long long size;
+
+		if (byte == std::char_traits<char>::eof() || !readVarint(frameTick) || !readVarint(size))
+			return false;
+
+		if (size > framesEnd - (unsigned long long)file.tellg())
+			return false;
+
+		payload.resize((size_t)size);
+		file.read((char*)payload.data(), payload.size());
+
+		kind = (unsigned char)byte;
+		tick = (long long)frameTick;
+
+		return (bool)file;
+	}
+
+	bool readIndex(long long size)
+	{
+		if (size < DeltaJournalFormat::HEADER_SIZE + DeltaJournalFormat::TRAILER_SIZE)
+			return false;
+
+		unsigned char trailer[DeltaJournalFormat::TRAILER_SIZE];
+		file.seekg(size - DeltaJournalFormat::TRAILER_SIZE);
+		file.read((char*)trailer, sizeof(trailer));
+
+		if (!file || BinaryUtility::readU32(trailer + 16) != DeltaJournalFormat::INDEX_MAGIC)
+			return false;
+
+		unsigned long long count = BinaryUtility::readU64(trailer);
+
+		if (count > (unsigned long long)size / DeltaJournalFormat::INDEX_ENTRY_SIZE)
+			return false;
+
+		std::vector<unsigned char> index((size_t)count * DeltaJournalFormat::INDEX_ENTRY_SIZE);
+		framesEnd = (unsigned long long)size - DeltaJournalFormat::TRAILER_SIZE - index.size();
+
+		file.seekg((std::streamoff)framesEnd);
+		file.read((char*)index.data(), index.size());
+
+		if (!file)
+			return false;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			DeltaJournalFormat::Keyframe keyframe;
+			keyframe.tick = (long long)BinaryUtility::readU64(index.data() + i * DeltaJournalFormat::INDEX_ENTRY_SIZE);
+			keyframe.offset = BinaryUtility::readU64(index.data() + i * DeltaJournalFormat::INDEX_ENTRY_SIZE + 8);
+
+			keyframes.push_back(keyframe);
+		}
+
+		lastTick = (long long)BinaryUtility::readU64(trailer + 8);
+
+		return true;
+	}
+
+	// Recovers the index of a journal whose writer never closed it, stopping at the first incomplete or out-of-order frame
+	void scanIndex(long long size)
+	{
+		framesEnd = (unsigned long long)size;
+		file.clear();
+		file.seekg(DeltaJournalFormat::HEADER_SIZE);
+
+		unsigned long long offset = DeltaJournalFormat::HEADER_SIZE;
+		unsigned char kind;
+		long long tick;
+
+		while (readFrame(kind, tick) && kind <= DeltaJournalFormat::KEYFRAME && tick >= lastTick)
+		{
+			if (kind == DeltaJournalFormat::KEYFRAME)
+			{
+				DeltaJournalFormat::Keyframe keyframe;
+				keyframe.tick = tick;
+				keyframe.offset = offset;
+
+				keyframes.push_back(keyframe);
+			}
+
+			lastTick = tick;
+			offset = (unsigned long long)file.tellg();
+		}
+
+		framesEnd = offset;
+	}
+
+public:
+	DeltaJournalReader() : framesEnd(0), lastTick(-1) {}
+
+	bool open(std::string path)
+	{
+		keyframes.clear();
+		lastTick = -1;
+
+		file.open(path, std::ios::binary | std::ios::ate);
+
+		if (!file)
+			return false;
+
+		long long size = (long long)file.tellg();
+		unsigned char header[DeltaJournalFormat::HEADER_SIZE];
+
+		file.seekg(0);
+		file.read((char*)header, sizeof(header));
+
+		if (!file || BinaryUtility::readU32(header) != DeltaJournalFormat::MAGIC || BinaryUtility::readU32(header + 4) != DeltaJournalFormat::VERSION)
+			return false;
+
+		if (!readIndex(size))
+		{
+			keyframes.clear();
+			scanIndex(size);
+		}
+
+		return !keyframes.empty();
+	}
+
+	long long getFirstTick() { return keyframes.empty() ? -1 : keyframes.front().tick; }
+	long long getLastTick() { return lastTick; }
+	size_t getKeyframeCount() { return keyframes.size(); }
+
+	// Restores the last recorded tick at or before the given one
+	bool seek(long long tick, Model* model)
+	{
+		int first = (int)keyframes.size() - 1;
+
+		while (first >= 0 && keyframes[first].tick > tick)
+			first--;
+
+		if (first < 0)
+			return false;
+
+		file.clear();
+		file.seekg((std::streamoff)keyframes[first].offset);
+
+		unsigned char kind;
+		long long frameTick;
+
+		if (!readFrame(kind, frameTick) || kind != DeltaJournalFormat::KEYFRAME || !model->loadBinary(payload.data(), payload.size()))
+			return false;
+
+		std::vector<EntityRecord> records = model->getRecords();
+		int lastId = model->getLastId();
+		unsigned long long randomState = model->getRandom().getState();
+		long long appliedTick = frameTick;
+
+		while (true)
+		{
+			std::streamoff next = file.tellg();
+
+			if (!readFrame(kind, frameTick) || kind != DeltaJournalFormat::DELTA_FRAME || frameTick > tick)
+			{
+				file.clear();
+				file.seekg(next);
+				break;
+			}
+
+			DeltaJournalFormat::applyDelta(records, payload.data(), payload.data() + payload.size(), lastId, randomState);
+			appliedTick = frameTick;
+		}
+
+		if (appliedTick == keyframes[first].tick)
+			return true;
+
+		model->loadRecords(records);
+		model->setLastId(lastId);
+		model->setTick(appliedTick);
+		model->getRandom().setState(randomState);
+
+		return true;
+	}
+};
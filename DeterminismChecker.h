@@ -0,0 +1,270 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <fstream>
+#include "BinaryUtility.h"
+#include "EntityRecord.h"
+#include "Model.h"
+#include "View.h"
+#include "Controller.h"
+
+struct DeterminismResult
+{
+	unsigned long long seed;
+	long long ticks;
+	unsigned long long hash;
+	bool isDiverged;
+
+	// Filled on divergence
+	std::string engine;
+	long long tick;
+	std::string difference;
+	std::vector<std::string> dumps;
+
+	DeterminismResult() : seed(0), ticks(0), hash(0), isDiverged(false), tick(-1) {}
+};
+
+// Runs engines side by side from one seeded world and compares canonical world hashes after every tick
+class DeterminismChecker
+{
+public:
+	struct Engine
+	{
+		std::string name;
+
+		// Builds this engine's world from another; also reapplied every rebuildEvery ticks when that is positive
+		std::function<Model*(Model*)> rebuild;
+		long long rebuildEvery;
+
+		// Advances the world one tick; the reference Controller::nextStateOfModel when empty
+		std::function<void(Model*, Controller*)> step;
+	};
+
+private:
+	struct Run
+	{
+		Engine engine;
+		std::unique_ptr<Model> model;
+		std::unique_ptr<View> view;
+		std::unique_ptr<Controller> controller;
+	};
+
+	std::vector<Engine> engines;
+	std::string dumpPrefix;
+
+	std::vector<EntityRecord> referenceRecords;
+	std::vector<EntityRecord> otherRecords;
+
+	static unsigned long long mix(unsigned long long hash, unsigned long long word)
+	{
+		hash ^= word;
+		hash *= 0x9E3779B97F4A7C15ULL;
+
+		return hash ^ (hash >> 29);
+	}
+
+	static void reset(Run& run, Model* model)
+	{
+		run.controller.reset();
+		run.view.reset();
+		run.model.reset(model);
+		run.view.reset(new View(model));
+		run.controller.reset(new Controller(model, run.view.get()));
+	}
+
+	static std::string describeRecord(const EntityRecord& record)
+	{
+		return "id " + std::to_string(record.id) + " at " + std::to_string(record.xPos) + "," + std::to_string(record.yPos);
+	}
+
+	static bool compareField(const std::string& prefix, const char* field, long long reference, long long other, std::string& message)
+	{
+		if (reference == other)
+			return false;
+
+		message = prefix + field + ": reference " + std::to_string(reference) + ", other " + std::to_string(other);
+
+		return true;
+	}
+
+	// Names the first header field or entity field that differs, walking both worlds in id order
+	std::string findDifference(Model* reference, Model* other)
+	{
+		if (reference->getTick() != other->getTick())
+			return "tick: reference " + std::to_string(reference->getTick()) + ", other " + std::to_string(other->getTick());
+
+		if (reference->getLastId() != other->getLastId())
+			return "lastId: reference " + std::to_string(reference->getLastId()) + ", other " + std::to_string(other->getLastId());
+
+		if (reference->getRandom().getState() != other->getRandom().getState())
+			return "random state: reference " + std::to_string(reference->getRandom().getState()) + ", other " + std::to_string(other->getRandom().getState());
+
+		reference->getRecords(referenceRecords);
+		other->getRecords(otherRecords);
+
+		size_t i = 0;
+
+		for (; i < referenceRecords.size() && i < otherRecords.size(); i++)
+		{
+			const EntityRecord& a = referenceRecords[i];
+			const EntityRecord& b = otherRecords[i];
+
+			if (a.id != b.id)
+				return "entity " + describeRecord(a.id < b.id ? a : b) + " only in " + (a.id < b.id ? "reference" : "other");
+
+			std::string prefix = "entity " + std::to_string(a.id) + " ";
+
+			std::string message;
+
+			if (compareField(prefix, "xPos", a.xPos, b.xPos, message) || compareField(prefix, "yPos", a.yPos, b.yPos, message)
+				|| compareField(prefix, "state", a.state, b.state, message) || compareField(prefix, "health", a.health, b.health, message)
+				|| compareField(prefix, "hunger", a.hunger, b.hunger, message) || compareField(prefix, "old", a.old, b.old, message)
+				|| compareField(prefix, "target", a.target, b.target, message) || compareField(prefix, "callee", a.callee, b.callee, message)
+				|| compareField(prefix, "flags", a.flags, b.flags, message))
+				return message;
+		}
+
+		if (i < referenceRecords.size())
+			return "entity " + describeRecord(referenceRecords[i]) + " only in reference";
+
+		if (i < otherRecords.size())
+			return "entity " + describeRecord(otherRecords[i]) + " only in other";
+
+		return "hashes differ but no field does";
+	}
+
+	std::string dump(Model* model, const std::string& engine, unsigned long long seed)
+	{
+		std::string path = dumpPrefix + "." + std::to_string(seed) + "." + engine + ".txt";
+		std::ofstream out(path, std::ios::trunc);
+
+		out << "tick " << model->getTick() << " random " << model->getRandom().getState() << "\n";
+		model->serialize(out);
+
+		return path;
+	}
+
+	bool compare(Run& reference, Run& run, unsigned long long seed, DeterminismResult& result)
+	{
+		if (hashWorld(reference.model.get()) == hashWorld(run.model.get()))
+			return true;
+
+		result.isDiverged = true;
+		result.engine = run.engine.name;
+		result.tick = reference.model->getTick();
+		result.difference = findDifference(reference.model.get(), run.model.get());
+
+		if (!dumpPrefix.empty())
+		{
+			result.dumps.push_back(dump(reference.model.get(), reference.engine.name, seed));
+			result.dumps.push_back(dump(run.model.get(), run.engine.name, seed));
+		}
+
+		return false;
+	}
+
+public:
+	DeterminismChecker() {}
+
+	// Canonical 64-bit hash of the world: header fields, then entity records in id order
+	static unsigned long long hashWorld(Model* model)
+	{
+		unsigned long long hash = 0xCBF29CE484222325ULL;
+
+		hash = mix(hash, ((unsigned long long)(unsigned int)model->getMap()->getHeight() << 32) | (unsigned int)model->getMap()->getWidth());
+		hash = mix(hash, (unsigned long long)model->getTick());
+		hash = mix(hash, (unsigned long long)(unsigned int)model->getLastId());
+		hash = mix(hash, model->getRandom().getState());
+		hash = mix(hash, (unsigned long long)model->getEntities().size());
+
+		unsigned char bytes[EntityRecord::SIZE];
+
+		for (Entity* entity : model->getEntities())
+		{
+			EntityRecord::fromEntity(entity).write(bytes);
+
+			for (int i = 0; i < EntityRecord::SIZE; i += 8)
+				hash = mix(hash, BinaryUtility::readU64(bytes + i));
+		}
+
+		return hash;
+	}
+
+	// Deep copy through the Model copy constructor
+	static Engine forkEngine(long long rebuildEvery)
+	{
+		return { "fork", [](Model* model) { return model->fork(); }, rebuildEvery, nullptr };
+	}
+
+	// Round trip through the versioned binary snapshot into a freshly built Model
+	static Engine snapshotEngine(long long rebuildEvery)
+	{
+		return { "snapshot", [](Model* model)
+			{
+				std::vector<unsigned char> buffer;
+				model->saveBinary(buffer);
+
+				Model* restored = new Model(8, 8, 0);
+				restored->loadBinary(buffer.data(), buffer.size());
+
+				return restored;
+			}, rebuildEvery, nullptr };
+	}
+
+	void addEngine(Engine engine) { engines.push_back(engine); }
+	void setDumpPrefix(std::string prefix) { dumpPrefix = prefix; }
+
+	// The reference is a plain fork stepped by Controller::nextStateOfModel; stops at the first divergence
+	DeterminismResult run(Model* initial, unsigned long long seed, long long ticks)
+	{
+		DeterminismResult result;
+		result.seed = seed;
+
+		Run reference;
+		reference.engine = { "reference", nullptr, 0, nullptr };
+		reset(reference, initial->fork());
+
+		std::vector<Run> runs(engines.size());
+
+		for (size_t i = 0; i < engines.size(); i++)
+		{
+			runs[i].engine = engines[i];
+			reset(runs[i], engines[i].rebuild(initial));
+
+			if (!compare(reference, runs[i], seed, result))
+				return result;
+		}
+
+		for (long long tick = 1; tick <= ticks; tick++)
+		{
+			reference.controller->nextStateOfModel();
+
+			for (Run& run : runs)
+			{
+				if (run.engine.step)
+					run.engine.step(run.model.get(), run.controller.get());
+				else
+					run.controller->nextStateOfModel();
+
+				if (!compare(reference, run, seed, result))
+					return result;
+
+				if (run.engine.rebuildEvery > 0 && tick % run.engine.rebuildEvery == 0)
+				{
+					reset(run, run.engine.rebuild(run.model.get()));
+
+					if (!compare(reference, run, seed, result))
+						return result;
+				}
+			}
+
+			result.ticks = tick;
+		}
+
+		result.hash = hashWorld(reference.model.get());
+
+		return result;
+	}
+};
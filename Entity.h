@@ -40,6 +40,10 @@ public:
 		pos = position;
 	}
 
+	virtual ~Entity() {}
+
+	virtual Entity* clone() { return new Entity(*this); }
+
 	int getId() { return id; }
 	int getOld() { return old; }
 	int getHealth() { return health; }
@@ -109,4 +113,12 @@ public:
 	{
 		entity->setCallee(this);
 	}
+};
+
+struct EntityIdLess
+{
+	bool operator()(Entity* one, Entity* another) const
+	{
+		return one->getId() < another->getId();
+	}
 };
\ No newline at end of file
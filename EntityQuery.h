@@ -0,0 +1,162 @@
+#pragma once
+#include <string>
+#include "Entity.h"
+#include "EntityState.h"
+#include "BlockCounts.h"
+
+struct EntityQuery
+{
+	enum SortColumn
+	{
+		BY_ID,
+		BY_OLD,
+		BY_HEALTH,
+		BY_HUNGER,
+		BY_POSITION,
+		SORT_COLUMN_COUNT
+	};
+
+	static const int ANY = -1;
+	static const int STATE_COUNT = DIED + 1;
+	static const int FEMALE = 0;
+	static const int MALE = 1;
+
+	int sortColumn;
+	bool descending;
+
+	int kind;
+	int sex;
+	int state;
+
+	bool hasRegion;
+	int left;
+	int bottom;
+	int right;
+	int top;
+
+	int offset;
+	int limit;
+
+	EntityQuery() : sortColumn(BY_ID), descending(false), kind(ANY), sex(ANY), state(ANY),
+		hasRegion(false), left(1), bottom(1), right(0), top(0), offset(0), limit(20) {}
+
+	bool isUnfiltered() const
+	{
+		return kind == ANY && sex == ANY && state == ANY && !hasRegion;
+	}
+
+	bool matches(Entity* entity) const
+	{
+		if (kind != ANY && BlockCounts::kindOf(entity) != kind)
+			return false;
+
+		if (sex != ANY && (!entity->isAnimal() || entity->isMale() != (sex == MALE)))
+			return false;
+
+		if (state != ANY && entity->getState() != state)
+			return false;
+
+		if (hasRegion)
+		{
+			Position pos = entity->getPosition();
+
+			if (pos.getX() < left || pos.getX() > right || pos.getY() < bottom || pos.getY() > top)
+				return false;
+		}
+
+		return true;
+	}
+
+	long long keyOf(Entity* entity) const
+	{
+		switch (sortColumn)
+		{
+		case BY_OLD:
+			return entity->getOld();
+
+		case BY_HEALTH:
+			return entity->getHealth();
+
+		case BY_HUNGER:
+			return entity->getHunger();
+
+		case BY_POSITION:
+			return (long long)entity->getPosition().getX() << 32 | (unsigned int)entity->getPosition().getY();
+		}
+
+		return entity->getId();
+	}
+
+	static const char* getSortColumnName(int column)
+	{
+		static const char* names[] = { "ID", "OLD", "HEALTH", "HUNGER", "POSITION" };
+
+		return column >= 0 && column < SORT_COLUMN_COUNT ? names[column] : "?";
+	}
+
+	static const char* getKindName(int kind)
+	{
+		static const char* names[] = { "Plant Eating", "Predator", "Plant", "Food" };
+
+		return kind >= 0 && kind < BlockCounts::KIND_COUNT ? names[kind] : "any";
+	}
+
+	// Parses comma-separated filter terms such as "predator,male,searchingeat"; "all" matches everything
+	bool parseFilter(const std::string& text, std::string& error)
+	{
+		static const char* kindNames[] = { "planteating", "predator", "plant", "food" };
+		static const char* stateNames[] = { "idle", "searchingeat", "eating", "runaway", "waitingpair", "searchingpair", "reproducing", "died" };
+
+		kind = sex = state = ANY;
+
+		size_t start = 0;
+
+		while (start <= text.size())
+		{
+			size_t end = text.find(',', start);
+
+			if (end == std::string::npos)
+				end = text.size();
+
+			std::string term = text.substr(start, end - start);
+			bool isKnown = term == "all";
+
+			for (int i = 0; i < BlockCounts::KIND_COUNT && !isKnown; i++)
+				if (term == kindNames[i])
+				{
+					kind = i;
+					isKnown = true;
+				}
+
+			for (int i = 0; i < STATE_COUNT && !isKnown; i++)
+				if (term == stateNames[i])
+				{
+					state = i;
+					isKnown = true;
+				}
+
+			if (term == "male" || term == "female")
+			{
+				sex = term == "male" ? MALE : FEMALE;
+				isKnown = true;
+			}
+
+			if (!isKnown)
+			{
+				error = "unknown filter term '" + term + "'";
+				return false;
+			}
+
+			start = end + 1;
+		}
+
+		return true;
+	}
+
+	static const char* getStateName(int state)
+	{
+		static const char* names[] = { "Idle", "Searching Eat", "Eating", "Runaway", "Waiting Pair", "Searching Pair", "Reproducing", "Died" };
+
+		return state >= 0 && state < STATE_COUNT ? names[state] : "any";
+	}
+};
@@ -0,0 +1,150 @@
+#pragma once
+#include "BinaryUtility.h"
+#include "Entity.h"
+#include "Animal.h"
+#include "Plant.h"
+#include "Food.h"
+
+struct EntityRecord
+{
+	static const int SIZE = 24;
+
+	static const int ANIMAL = 0;
+	static const int PLANT = 1;
+	static const int FOOD = 2;
+
+	static const unsigned char ACTIVE_FLAG = 1;
+	static const unsigned char MALE_FLAG = 2;
+	static const unsigned char PREDATOR_FLAG = 4;
+
+	int id;
+	int target;
+	int callee;
+	unsigned short xPos;
+	unsigned short yPos;
+	unsigned short old;
+	unsigned short health;
+	unsigned short hunger;
+	unsigned char state;
+	unsigned char flags;
+
+	static int typeOf(Entity* ent)
+	{
+		if (ent->isAnimal())
+			return ANIMAL;
+
+		else if (ent->isPlant())
+			return PLANT;
+
+		return FOOD;
+	}
+
+	static EntityRecord fromEntity(Entity* ent)
+	{
+		EntityRecord record;
+
+		record.id = ent->getId();
+		record.target = ent->getTarget() ? ent->getTarget()->getId() : -1;
+		record.callee = ent->getCallee() ? ent->getCallee()->getId() : -1;
+		record.xPos = (unsigned short)ent->getPosition().getX();
+		record.yPos = (unsigned short)ent->getPosition().getY();
+		record.old = (unsigned short)ent->getOld();
+		record.health = (unsigned short)ent->getHealth();
+		record.hunger = (unsigned short)ent->getHunger();
+		record.state = (unsigned char)ent->getState();
+
+		record.flags = (unsigned char)(typeOf(ent) << 3);
+
+		if (ent->isActive())
+			record.flags |= ACTIVE_FLAG;
+
+		if (ent->isMale())
+			record.flags |= MALE_FLAG;
+
+		if (ent->isPredator())
+			record.flags |= PREDATOR_FLAG;
+
+		return record;
+	}
+
+	int getType() const { return flags >> 3; }
+	bool isActive() const { return flags & ACTIVE_FLAG; }
+	bool isMale() const { return flags & MALE_FLAG; }
+	bool isPredator() const { return flags & PREDATOR_FLAG; }
+
+	char getSymbol() const
+	{
+		if (getType() == ANIMAL)
+			return isPredator() ? '&' : '@';
+
+		return getType() == PLANT ? 'X' : '*';
+	}
+
+	const char* getTypeName() const
+	{
+		if (getType() == ANIMAL)
+			return isPredator() ? "Predator" : "Plant Eating";
+
+		return getType() == PLANT ? "Plant" : "Food";
+	}
+
+	const char* getSexNotation() const
+	{
+		if (getType() != ANIMAL)
+			return "N/A";
+
+		return isMale() ? "Male" : "Female";
+	}
+
+	Entity* toEntity() const
+	{
+		Entity* result = nullptr;
+		Position pos(xPos, yPos);
+
+		if (getType() == ANIMAL)
+			result = new Animal(id, isPredator(), old, health, hunger, isActive(), isMale(), pos);
+
+		else if (getType() == PLANT)
+			result = new Plant(id, old, health, hunger, isActive(), pos);
+
+		else if (getType() == FOOD)
+			result = new Food(id, old, health, hunger, isActive(), pos);
+
+		if (result)
+			result->setState((EntityState)state);
+
+		return result;
+	}
+
+	void write(unsigned char* out) const
+	{
+		BinaryUtility::writeU32(out, (unsigned int)id);
+		BinaryUtility::writeU32(out + 4, (unsigned int)target);
+		BinaryUtility::writeU32(out + 8, (unsigned int)callee);
+		BinaryUtility::writeU16(out + 12, xPos);
+		BinaryUtility::writeU16(out + 14, yPos);
+		BinaryUtility::writeU16(out + 16, old);
+		BinaryUtility::writeU16(out + 18, health);
+		BinaryUtility::writeU16(out + 20, hunger);
+		out[22] = state;
+		out[23] = flags;
+	}
+
+	static EntityRecord read(const unsigned char* in)
+	{
+		EntityRecord record;
+
+		record.id = (int)BinaryUtility::readU32(in);
+		record.target = (int)BinaryUtility::readU32(in + 4);
+		record.callee = (int)BinaryUtility::readU32(in + 8);
+		record.xPos = BinaryUtility::readU16(in + 12);
+		record.yPos = BinaryUtility::readU16(in + 14);
+		record.old = BinaryUtility::readU16(in + 16);
+		record.health = BinaryUtility::readU16(in + 18);
+		record.hunger = BinaryUtility::readU16(in + 20);
+		record.state = in[22];
+		record.flags = in[23];
+
+		return record;
+	}
+};
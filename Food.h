@@ -10,6 +10,8 @@ public:
 	{
 	}
 
+	virtual Entity* clone() { return new Food(*this); }
+
 	virtual bool isOld()
 	{
 		return old == getMaxOld();
@@ -0,0 +1,482 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "EntityRecord.h"
+#include "EntityState.h"
+#include "Position.h"
+#include "Model.h"
+#include "Tracer.h"
+
+class FrameExporter
+{
+public:
+	enum Format
+	{
+		PPM,
+		PNG
+	};
+
+	static const int DANGER_RADIUS = 3;
+	static const int DANGER_SIDE = 2 * DANGER_RADIUS + 1;
+
+private:
+	struct Frame
+	{
+		long long tick;
+		int height;
+		int width;
+		std::vector<EntityRecord> records;
+	};
+
+	std::string prefix;
+	Format format;
+	long long everyTicks;
+	int scale;
+	bool dangerIsShown;
+	size_t maxQueued;
+
+	std::deque<Frame> queued;
+	std::vector<Frame> spare;
+	Frame writing;
+	bool busy;
+	bool stopping;
+
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::condition_variable idle;
+	std::thread writer;
+
+	std::vector<unsigned char> pixels;
+	std::vector<unsigned char> scanlines;
+	std::vector<unsigned char> encoded;
+	std::vector<int> danger;
+	int dangerKernel[DANGER_SIDE * DANGER_SIDE];
+
+	unsigned int crcTable[256];
+
+	std::atomic<long long> writtenCount;
+	std::atomic<long long> failedCount;
+	std::atomic<long long> stallCount;
+
+	void initDangerKernel()
+	{
+		// Model::getDangerLevel summed over a single predator at each offset
+		std::memset(dangerKernel, 0, sizeof(dangerKernel));
+
+		Position origin(0, 0);
+		std::set<Position> inner = origin.getAdjacent();
+		std::set<Position> outer;
+
+		for (Position current : inner)
+		{
+			for (Position pos : current.getAdjacent())
+			{
+				dangerKernel[(pos.getY() + DANGER_RADIUS) * DANGER_SIDE + pos.getX() + DANGER_RADIUS] += 2;
+				outer.insert(pos);
+			}
+		}
+
+		for (Position current : outer)
+			for (Position pos : current.getAdjacent())
+				dangerKernel[(pos.getY() + DANGER_RADIUS) * DANGER_SIDE + pos.getX() + DANGER_RADIUS] += 1;
+	}
+
+	void initCrcTable()
+	{
+		for (unsigned int n = 0; n < 256; n++)
+		{
+			unsigned int c = n;
+
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+
+			crcTable[n] = c;
+		}
+	}
+
+	unsigned int crc(const unsigned char* data, size_t size)
+	{
+		unsigned int c = 0xFFFFFFFFu;
+
+		for (size_t i = 0; i < size; i++)
+			c = crcTable[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+
+		return c ^ 0xFFFFFFFFu;
+	}
+
+	static void appendBigEndian(std::vector<unsigned char>& out, unsigned int value)
+	{
+		out.push_back((unsigned char)(value >> 24));
+		out.push_back((unsigned char)(value >> 16));
+		out.push_back((unsigned char)(value >> 8));
+		out.push_back((unsigned char)value);
+	}
+
+	static void getColor(const EntityRecord& record, unsigned char* rgb)
+	{
+		static const unsigned char kinds[4][3] = { { 70, 130, 255 }, { 230, 40, 40 }, { 40, 190, 60 }, { 230, 200, 60 } };
+		static const int brightness[] = { 70, 100, 100, 100, 85, 85, 100, 40 };
+
+		int kind = 3;
+
+		if (record.getType() == EntityRecord::ANIMAL)
+			kind = record.isPredator() ? 1 : 0;
+
+		else if (record.getType() == EntityRecord::PLANT)
+			kind = 2;
+
+		int state = record.state <= DIED ? (int)record.state : (int)IDLE;
+
+		for (int i = 0; i < 3; i++)
+		{
+			int value = kinds[kind][i] * brightness[state] / 100;
+
+			if (state == REPRODUCING)
+				value = (value + 255) / 2;
+
+			else if (state == DIED)
+				value = (value + 110) / 2;
+
+			rgb[i] = (unsigned char)value;
+		}
+	}
+
+	void render(const Frame& frame)
+	{
+		int imageWidth = frame.width * scale;
+		int imageHeight = frame.height * scale;
+
+		pixels.assign((size_t)imageWidth * imageHeight * 3, 24);
+
+		if (dangerIsShown)
+		{
+			danger.assign((size_t)frame.width * frame.height, 0);
+
+			for (const EntityRecord& record : frame.records)
+			{
+				if (record.getType() != EntityRecord::ANIMAL || !record.isPredator())
+					continue;
+
+				for (int dy = -DANGER_RADIUS; dy <= DANGER_RADIUS; dy++)
+					for (int dx = -DANGER_RADIUS; dx <= DANGER_RADIUS; dx++)
+					{
+						int x = record.xPos - dx - 1;
+						int y = record.yPos - dy - 1;
+
+						if (x >= 0 && x < frame.width && y >= 0 && y < frame.height)
+							danger[(size_t)y * frame.width + x] += dangerKernel[(dy + DANGER_RADIUS) * DANGER_SIDE + dx + DANGER_RADIUS];
+					}
+			}
+
+			for (int y = 0; y < frame.height; y++)
+				for (int x = 0; x < frame.width; x++)
+				{
+					int level = danger[(size_t)y * frame.width + x];
+
+					if (level > 0)
+						fillTile(frame, x + 1, y + 1, (unsigned char)std::min(255, 48 + level * 12), 24, 24);
+				}
+		}
+
+		unsigned char rgb[3];
+
+		for (const EntityRecord& record : frame.records)
+		{
+			getColor(record, rgb);
+			fillTile(frame, record.xPos, record.yPos, rgb[0], rgb[1], rgb[2]);
+		}
+	}
+
+	void fillTile(const Frame& frame, int xPos, int yPos, unsigned char red, unsigned char green, unsigned char blue)
+	{
+		if (xPos < 1 || xPos > frame.width || yPos < 1 || yPos > frame.height)
+			return;
+
+		size_t imageWidth = (size_t)frame.width * scale;
+		size_t top = (size_t)(frame.height - yPos) * scale;
+		size_t left = (size_t)(xPos - 1) * scale;
+
+		for (int row = 0; row < scale; row++)
+		{
+			unsigned char* out = pixels.data() + ((top + row) * imageWidth + left) * 3;
+
+			for (int column = 0; column < scale; column++)
+			{
+				*out++ = red;
+				*out++ = green;
+				*out++ = blue;
+			}
+		}
+	}
+
+	void encodePpm(int imageWidth, int imageHeight)
+	{
+		char header[64];
+		int length = std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", imageWidth, imageHeight);
+
+		encoded.assign(header, header + length);
+		encoded.insert(encoded.end(), pixels.begin(), pixels.end());
+	}
+
+	size_t beginChunk(const char* type)
+	{
+		size_t start = encoded.size();
+
+		appendBigEndian(encoded, 0);
+		encoded.insert(encoded.end(), type, type + 4);
+
+		return start;
+	}
+
+	void endChunk(size_t start)
+	{
+		unsigned int length = (unsigned int)(encoded.size() - start - 8);
+
+		for (int i = 0; i < 4; i++)
+			encoded[start + i] = (unsigned char)(length >> (24 - 8 * i));
+
+		appendBigEndian(encoded, crc(encoded.data() + start + 4, length + 4));
+	}
+
+	static unsigned int adler(const unsigned char* data, size_t size, unsigned int value)
+	{
+		static const size_t MAX_RUN = 5552;
+
+		unsigned int a = value & 0xFFFF;
+		unsigned int b = value >> 16;
+
+		while (size > 0)
+		{
+			size_t run = std::min(size, MAX_RUN);
+
+			for (size_t i = 0; i < run; i++)
+			{
+				a += data[i];
+				b += a;
+			}
+
+			a %= 65521;
+			b %= 65521;
+
+			data += run;
+			size -= run;
+		}
+
+		return b << 16 | a;
+	}
+
+	void encodePng(int imageWidth, int imageHeight)
+	{
+		static const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+		static const size_t MAX_STORED_BLOCK = 65535;
+
+		size_t rowSize = (size_t)imageWidth * 3;
+
+		scanlines.resize((rowSize + 1) * imageHeight);
+
+		for (int row = 0; row < imageHeight; row++)
+		{
+			scanlines[row * (rowSize + 1)] = 0;
+			std::memcpy(scanlines.data() + row * (rowSize + 1) + 1, pixels.data() + row * rowSize, rowSize);
+		}
+
+		encoded.assign(signature, signature + sizeof(signature));
+		encoded.reserve(encoded.size() + scanlines.size() + scanlines.size() / MAX_STORED_BLOCK * 5 + 128);
+
+		size_t chunk = beginChunk("IHDR");
+		appendBigEndian(encoded, (unsigned int)imageWidth);
+		appendBigEndian(encoded, (unsigned int)imageHeight);
+		encoded.push_back(8);
+		encoded.push_back(2);
+		encoded.push_back(0);
+		encoded.push_back(0);
+		encoded.push_back(0);
+		endChunk(chunk);
+
+		chunk = beginChunk("IDAT");
+		encoded.push_back(0x78);
+		encoded.push_back(0x01);
+
+		size_t offset = 0;
+
+		do
+		{
+			size_t block = std::min(scanlines.size() - offset, MAX_STORED_BLOCK);
+
+			encoded.push_back(offset + block == scanlines.size() ? 1 : 0);
+			encoded.push_back((unsigned char)block);
+			encoded.push_back((unsigned char)(block >> 8));
+			encoded.push_back((unsigned char)~block);
+			encoded.push_back((unsigned char)(~block >> 8));
+			encoded.insert(encoded.end(), scanlines.begin() + offset, scanlines.begin() + offset + block);
+
+			offset += block;
+		} while (offset < scanlines.size());
+
+		appendBigEndian(encoded, adler(scanlines.data(), scanlines.size(), 1));
+		endChunk(chunk);
+
+		endChunk(beginChunk("IEND"));
+	}
+
+	bool write(const Frame& frame)
+	{
+		render(frame);
+
+		int imageWidth = frame.width * scale;
+		int imageHeight = frame.height * scale;
+
+		if (format == PNG)
+			encodePng(imageWidth, imageHeight);
+
+		else
+			encodePpm(imageWidth, imageHeight);
+
+		char name[32];
+		std::snprintf(name, sizeof(name), "%08lld%s", frame.tick, format == PNG ? ".png" : ".ppm");
+
+		std::ofstream file(prefix + name, std::ios::binary | std::ios::trunc);
+		file.write((const char*)encoded.data(), encoded.size());
+
+		return (bool)file;
+	}
+
+	void run()
+	{
+		Tracer::setThreadName("frame writer");
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (true)
+		{
+			wakeUp.wait(lock, [this]() { return !queued.empty() || stopping; });
+
+			if (queued.empty())
+				break;
+
+			std::swap(writing, queued.front());
+			queued.pop_front();
+			busy = true;
+
+			lock.unlock();
+
+			{
+				TRACE_SCOPE("frame write");
+
+				if (write(writing))
+					writtenCount++;
+
+				else
+					failedCount++;
+			}
+
+			lock.lock();
+
+			spare.push_back(Frame());
+			std::swap(spare.back(), writing);
+
+			busy = false;
+			idle.notify_all();
+		}
+	}
+
+public:
+	FrameExporter(std::string prefix, Format format = PPM, long long everyTicks = 1, int scale = 1, bool dangerIsShown = false, size_t maxQueued = 4)
+		: prefix(prefix), format(format), everyTicks(everyTicks > 0 ? everyTicks : 1), scale(scale > 0 ? scale : 1),
+		dangerIsShown(dangerIsShown), maxQueued(maxQueued > 0 ? maxQueued : 1), busy(false), stopping(false),
+		writtenCount(0), failedCount(0), stallCount(0)
+	{
+		initDangerKernel();
+		initCrcTable();
+
+		writer = std::thread(&FrameExporter::run, this);
+	}
+
+	~FrameExporter()
+	{
+		close();
+	}
+
+	void attach(Model* model)
+	{
+		model->addTickListener([this](Model* m)
+			{
+				this->onTick(m);
+			}
+		);
+	}
+
+	void onTick(Model* model)
+	{
+		if (model->getTick() % everyTicks == 0)
+			capture(model);
+	}
+
+	void capture(Model* model)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (queued.size() >= maxQueued)
+		{
+			stallCount++;
+			idle.wait(lock, [this]() { return queued.size() < maxQueued; });
+		}
+
+		Frame frame;
+
+		if (!spare.empty())
+		{
+			std::swap(frame, spare.back());
+			spare.pop_back();
+		}
+
+		lock.unlock();
+
+		frame.tick = model->getTick();
+		frame.height = model->getMap()->getHeight();
+		frame.width = model->getMap()->getWidth();
+		model->getRecords(frame.records);
+
+		lock.lock();
+
+		queued.push_back(Frame());
+		TRACE_COUNTER("frame queue", queued.size());
+		std::swap(queued.back(), frame);
+
+		lock.unlock();
+		wakeUp.notify_one();
+	}
+
+	void flush()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this]() { return queued.empty() && !busy; });
+	}
+
+	void close()
+	{
+		if (!writer.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		wakeUp.notify_one();
+		writer.join();
+	}
+
+	long long getWrittenCount() { return writtenCount; }
+	long long getFailedCount() { return failedCount; }
+	long long getStallCount() { return stallCount; }
+};
@@ -1,15 +1,131 @@
 #pragma once
 #include <iostream>
 #include <chrono>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <csignal>
+
+#ifdef _WIN32
 #include "conio.h"
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <termios.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+struct KeyEvent
+{
+	int key;
+	long long timestamp;
+};
 
 class KeyboardUtility
 {
+	// How long a lone escape byte waits for the rest of an arrow sequence before it counts as the Esc key
+	static const int ESCAPE_TIMEOUT_MILLISECONDS = 50;
+
 	static int previouslyPressedKey;
 	static int lastPressedKey;
-	static int lastTimePressedKey;
+	static long long lastTimePressedKey;
+
+	static long long delayBetweenKeyPressing;
+
+	static std::deque<KeyEvent> events;
+	static bool rawModeIsEnabled;
+	static bool inputIsClosed;
+
+#ifndef _WIN32
+	static struct termios originalMode;
+	static std::vector<unsigned char> pendingBytes;
+	static long long pendingSince;
+#endif
+
+	static void pushEvent(int key)
+	{
+		KeyEvent event;
+		event.key = key;
+		event.timestamp = now();
+
+		events.push_back(event);
+	}
+
+	static int arrowToKey(int code)
+	{
+		switch (code)
+		{
+		case 'A':
+			return 119;
+
+		case 'B':
+			return 115;
+
+		case 'C':
+			return 100;
 
-	static int delayBetweenKeyPressing;
+		case 'D':
+			return 97;
+		}
+
+		return -1;
+	}
+
+#ifndef _WIN32
+	static void restoreAndRaise(int signalNumber)
+	{
+		disableRawMode();
+
+		std::signal(signalNumber, SIG_DFL);
+		std::raise(signalNumber);
+	}
+
+	// Leaves an incomplete escape sequence at the end of the pending bytes for the next read
+	static void decodePendingBytes()
+	{
+		size_t i = 0;
+
+		for (; i < pendingBytes.size(); i++)
+		{
+			if (pendingBytes[i] == 27)
+			{
+				if (i + 1 == pendingBytes.size() || (pendingBytes[i + 1] == '[' && i + 2 == pendingBytes.size()))
+					break;
+
+				if (pendingBytes[i + 1] == '[')
+				{
+					int key = arrowToKey(pendingBytes[i + 2]);
+					i += 2;
+
+					if (key >= 0)
+						pushEvent(key);
+
+					continue;
+				}
+			}
+
+			pushEvent(pendingBytes[i] == '\n' ? 13 : pendingBytes[i]);
+		}
+
+		if (i > 0)
+			pendingSince = now();
+
+		pendingBytes.erase(pendingBytes.begin(), pendingBytes.begin() + i);
+	}
+
+	static void flushPendingBytes()
+	{
+		for (unsigned char byte : pendingBytes)
+			pushEvent(byte);
+
+		pendingBytes.clear();
+	}
+#endif
 
 public:
 	KeyboardUtility() {}
@@ -18,45 +134,176 @@ public:
 	{
 		previouslyPressedKey = -1;
 		lastPressedKey = -1;
-		lastTimePressedKey = delay;
+		lastTimePressedKey = 0;
 		delayBetweenKeyPressing = delay;
+
+		enableRawMode();
 	}
 
-	static bool delayIsGone()
+	static long long now()
 	{
-		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() - lastTimePressedKey>= delayBetweenKeyPressing;
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 	}
 
-	static void resetDelay()
+	static void enableRawMode()
 	{
-		lastTimePressedKey = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#ifndef _WIN32
+		if (rawModeIsEnabled || !isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &originalMode) != 0)
+			return;
+
+		struct termios raw = originalMode;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_iflag &= ~(ICRNL | IXON);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+
+		if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) != 0)
+			return;
+
+		static bool restoreIsRegistered = false;
+
+		if (!restoreIsRegistered)
+		{
+			std::atexit(disableRawMode);
+			std::signal(SIGINT, restoreAndRaise);
+			std::signal(SIGTERM, restoreAndRaise);
+			restoreIsRegistered = true;
+		}
+
+		rawModeIsEnabled = true;
+#endif
+	}
+
+	static void disableRawMode()
+	{
+#ifndef _WIN32
+		if (rawModeIsEnabled)
+			tcsetattr(STDIN_FILENO, TCSANOW, &originalMode);
+
+		rawModeIsEnabled = false;
+#endif
 	}
 
-	static bool isKeyPressed()
+	// Once stdin reaches end of file no more events arrive, and callers treat that as a request to exit
+	static bool isInputClosed() { return inputIsClosed && events.empty(); }
+
+	// For readers that bypass the event queue, such as the console's line reads; queued keys are dropped with the input
+	static void markInputClosed()
 	{
-		return _kbhit();
+		inputIsClosed = true;
+		events.clear();
 	}
 
-	static void handleKeyboard()
+	static bool pollEvents(int timeoutMilliseconds)
 	{
+		if (inputIsClosed)
+			return !events.empty();
+
+#ifdef _WIN32
+		if (!_kbhit())
+			WaitForSingleObject(GetStdHandle(STD_INPUT_HANDLE), timeoutMilliseconds < 0 ? INFINITE : (DWORD)timeoutMilliseconds);
+
+		while (_kbhit())
+		{
+			int key = _getch();
+
+			if (key == 0 || key == 224)
+			{
+				int code = _getch();
+				key = code == 72 ? arrowToKey('A') : code == 80 ? arrowToKey('B') : code == 77 ? arrowToKey('C') : code == 75 ? arrowToKey('D') : -1;
+			}
+
+			if (key >= 0)
+				pushEvent(key);
+		}
+#else
+		struct pollfd descriptor;
+		descriptor.fd = STDIN_FILENO;
+		descriptor.events = POLLIN;
+		descriptor.revents = 0;
+
+		int wait = timeoutMilliseconds;
+
+		if (!pendingBytes.empty())
+		{
+			int left = (int)std::max(0LL, pendingSince + ESCAPE_TIMEOUT_MILLISECONDS - now());
+			wait = wait < 0 ? left : std::min(wait, left);
+		}
+
+		if (poll(&descriptor, 1, wait) <= 0)
+		{
+			if (!pendingBytes.empty() && now() - pendingSince >= ESCAPE_TIMEOUT_MILLISECONDS)
+				flushPendingBytes();
+
+			return !events.empty();
+		}
+
+		unsigned char buffer[64];
+		ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+
+		if (count <= 0)
+		{
+			inputIsClosed = true;
+			flushPendingBytes();
+
+			return !events.empty();
+		}
+
+		if (pendingBytes.empty())
+			pendingSince = now();
+
+		pendingBytes.insert(pendingBytes.end(), buffer, buffer + count);
+		decodePendingBytes();
+#endif
+
+		return !events.empty();
+	}
+
+	static bool nextEvent(KeyEvent& event)
+	{
+		if (events.empty())
+			return false;
+
+		event = events.front();
+		events.pop_front();
+
+		return true;
+	}
+
+	static bool handleKeyboard(int timeoutMilliseconds = -1)
+	{
+		long long deadline = now() + timeoutMilliseconds;
+
 		while (true)
 		{
-			if (isKeyPressed())
+			KeyEvent event;
+
+			while (!nextEvent(event))
 			{
-				int pressedKey = _getch();
+				int wait = -1;
 
-				if (delayIsGone() || previouslyPressedKey != pressedKey)
+				if (timeoutMilliseconds >= 0)
 				{
-					resetDelay();
-					
-					previouslyPressedKey = lastPressedKey;
-					lastPressedKey = pressedKey;
+					wait = (int)(deadline - now());
 
-					break;
+					if (wait <= 0)
+						return false;
 				}
 
-				else
-					continue;
+				if (isInputClosed())
+					return false;
+
+				pollEvents(wait);
+			}
+
+			if (event.timestamp - lastTimePressedKey >= delayBetweenKeyPressing || lastPressedKey != event.key)
+			{
+				lastTimePressedKey = event.timestamp;
+
+				previouslyPressedKey = lastPressedKey;
+				lastPressedKey = event.key;
+
+				return true;
 			}
 		}
 	}
@@ -95,10 +342,70 @@ public:
 	{
 		return lastPressedKey == 59;
 	}
+
+	static bool onE()
+	{
+		return lastPressedKey == 101;
+	}
+
+	static bool onK()
+	{
+		return lastPressedKey == 107;
+	}
+
+	static bool onM()
+	{
+		return lastPressedKey == 109;
+	}
+
+	static bool onF()
+	{
+		return lastPressedKey == 102;
+	}
+
+	static bool onP()
+	{
+		return lastPressedKey == 112;
+	}
+
+	static bool onPeriod()
+	{
+		return lastPressedKey == 46;
+	}
+
+	static bool onR()
+	{
+		return lastPressedKey == 114;
+	}
+
+	static bool onV()
+	{
+		return lastPressedKey == 118;
+	}
+
+	static bool onPlus()
+	{
+		return lastPressedKey == 43 || lastPressedKey == 61;
+	}
+
+	static bool onMinus()
+	{
+		return lastPressedKey == 45 || lastPressedKey == 95;
+	}
 };
 
 int KeyboardUtility::previouslyPressedKey;
 int KeyboardUtility::lastPressedKey;
-int KeyboardUtility::lastTimePressedKey;
+long long KeyboardUtility::lastTimePressedKey;
+
+long long KeyboardUtility::delayBetweenKeyPressing;
+
+std::deque<KeyEvent> KeyboardUtility::events;
+bool KeyboardUtility::rawModeIsEnabled;
+bool KeyboardUtility::inputIsClosed;
 
-int KeyboardUtility::delayBetweenKeyPressing;
\ No newline at end of file
+#ifndef _WIN32
+struct termios KeyboardUtility::originalMode;
+std::vector<unsigned char> KeyboardUtility::pendingBytes;
+long long KeyboardUtility::pendingSince;
+#endif
\ No newline at end of file
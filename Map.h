@@ -18,6 +18,16 @@ public:
 		allPositions = another.allPositions;
 	}
 
+	Map& operator=(const Map& another)
+	{
+		mapHeight = another.mapHeight;
+		mapWidth = another.mapWidth;
+
+		allPositions = another.allPositions;
+
+		return *this;
+	}
+
 	Map(int mapHeight, int mapWidth)
 	{
 		this->mapHeight = mapHeight;
@@ -25,7 +35,7 @@ public:
 
 		for (int i = 0; i < mapHeight; i++)
 			for (int j = 0; j < mapWidth; j++)
-				allPositions.insert(Position(i + 1, j + 1));
+				allPositions.insert(Position(j + 1, i + 1));
 	}
 
 	std::set<Position> getAllPositions() { return allPositions; }
@@ -0,0 +1,358 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include "BinaryUtility.h"
+#include "EntityRecord.h"
+#include "Model.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+class MappedSnapshot
+{
+public:
+	static const unsigned int MAGIC = 0x43594144;
+	static const unsigned int VERSION = 1;
+	static const int HEADER_SIZE = 64;
+	static const int COLUMN_ENTRY_SIZE = 16;
+	static const int COLUMN_ALIGNMENT = 64;
+
+	enum Column
+	{
+		ID,
+		TARGET,
+		CALLEE,
+		XPOS,
+		YPOS,
+		OLD,
+		HEALTH,
+		HUNGER,
+		STATE,
+		FLAGS,
+		COLUMN_COUNT
+	};
+
+	// Read-only view of one column of the mapping; values decode little-endian on access and nothing is copied
+	class ColumnView
+	{
+		const unsigned char* begin;
+		size_t count;
+		int width;
+
+	public:
+		ColumnView(const unsigned char* begin, size_t count, int width) : begin(begin), count(count), width(width) {}
+
+		size_t size() const { return count; }
+
+		long long operator[](size_t index) const
+		{
+			const unsigned char* in = begin + index * width;
+
+			if (width == 4)
+				return (int)BinaryUtility::readU32(in);
+
+			else if (width == 2)
+				return BinaryUtility::readU16(in);
+
+			return *in;
+		}
+	};
+
+private:
+	const unsigned char* data;
+	size_t size;
+	bool valid;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+	static int columnWidth(int column)
+	{
+		if (column <= CALLEE)
+			return 4;
+
+		else if (column <= HUNGER)
+			return 2;
+
+		return 1;
+	}
+
+	static size_t align(size_t offset)
+	{
+		return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+	}
+
+	bool validate()
+	{
+		if (size < HEADER_SIZE + COLUMN_COUNT * COLUMN_ENTRY_SIZE)
+			return false;
+
+		if (BinaryUtility::readU32(data) != MAGIC || BinaryUtility::readU32(data + 4) != VERSION
+			|| BinaryUtility::readU32(data + 20) != COLUMN_COUNT)
+			return false;
+
+		unsigned long long count = getCount();
+
+		for (int column = 0; column < COLUMN_COUNT; column++)
+		{
+			const unsigned char* entry = data + HEADER_SIZE + column * COLUMN_ENTRY_SIZE;
+
+			unsigned long long offset = BinaryUtility::readU64(entry);
+			unsigned int width = BinaryUtility::readU32(entry + 8);
+
+			if (width != (unsigned int)columnWidth(column) || offset % COLUMN_ALIGNMENT != 0
+				|| offset > size || count > (size - offset) / width)
+				return false;
+		}
+
+		return true;
+	}
+
+	void unmap()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile((LPCVOID)data);
+
+		if (mapping)
+			CloseHandle(mapping);
+
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+#else
+		if (data)
+			munmap((void*)data, size);
+#endif
+
+		data = nullptr;
+		size = 0;
+		valid = false;
+	}
+
+public:
+	MappedSnapshot() : data(nullptr), size(0), valid(false)
+	{
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+#endif
+	}
+
+	MappedSnapshot(std::string path) : MappedSnapshot()
+	{
+		open(path);
+	}
+
+	MappedSnapshot(const MappedSnapshot&) = delete;
+	MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+	~MappedSnapshot()
+	{
+		unmap();
+	}
+
+	bool open(std::string path)
+	{
+		unmap();
+
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			unmap();
+			return false;
+		}
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+		if (!mapping)
+		{
+			unmap();
+			return false;
+		}
+
+		data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = (size_t)fileSize.QuadPart;
+#else
+		int descriptor = ::open(path.c_str(), O_RDONLY);
+
+		if (descriptor < 0)
+			return false;
+
+		struct stat status;
+
+		if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+		{
+			close(descriptor);
+			return false;
+		}
+
+		void* mapped = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		close(descriptor);
+
+		if (mapped == MAP_FAILED)
+			return false;
+
+		data = (const unsigned char*)mapped;
+		size = (size_t)status.st_size;
+#endif
+
+		if (!data)
+		{
+			unmap();
+			return false;
+		}
+
+		valid = validate();
+
+		return valid;
+	}
+
+	bool isValid() { return valid; }
+
+	int getHeight() { return (int)BinaryUtility::readU32(data + 8); }
+	int getWidth() { return (int)BinaryUtility::readU32(data + 12); }
+	int getLastId() { return (int)BinaryUtility::readU32(data + 16); }
+	long long getTick() { return (long long)BinaryUtility::readU64(data + 24); }
+	unsigned long long getCount() { return BinaryUtility::readU64(data + 32); }
+	unsigned long long getRandomState() { return BinaryUtility::readU64(data + 40); }
+
+	ColumnView getColumn(Column column)
+	{
+		return ColumnView(data + BinaryUtility::readU64(data + HEADER_SIZE + column * COLUMN_ENTRY_SIZE), (size_t)getCount(), columnWidth(column));
+	}
+
+	EntityRecord getRecord(size_t index)
+	{
+		EntityRecord record;
+
+		record.id = (int)getColumn(ID)[index];
+		record.target = (int)getColumn(TARGET)[index];
+		record.callee = (int)getColumn(CALLEE)[index];
+		record.xPos = (unsigned short)getColumn(XPOS)[index];
+		record.yPos = (unsigned short)getColumn(YPOS)[index];
+		record.old = (unsigned short)getColumn(OLD)[index];
+		record.health = (unsigned short)getColumn(HEALTH)[index];
+		record.hunger = (unsigned short)getColumn(HUNGER)[index];
+		record.state = (unsigned char)getColumn(STATE)[index];
+		record.flags = (unsigned char)getColumn(FLAGS)[index];
+
+		return record;
+	}
+
+	// Copies every record into heap entities; read through the column views to stay on the mapped pages
+	bool loadInto(Model* model)
+	{
+		if (!valid)
+			return false;
+
+		std::vector<EntityRecord> records((size_t)getCount());
+
+		ColumnView ids = getColumn(ID);
+		ColumnView targets = getColumn(TARGET);
+		ColumnView callees = getColumn(CALLEE);
+		ColumnView xs = getColumn(XPOS);
+		ColumnView ys = getColumn(YPOS);
+		ColumnView olds = getColumn(OLD);
+		ColumnView healths = getColumn(HEALTH);
+		ColumnView hungers = getColumn(HUNGER);
+		ColumnView states = getColumn(STATE);
+		ColumnView flags = getColumn(FLAGS);
+
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			records[i].id = (int)ids[i];
+			records[i].target = (int)targets[i];
+			records[i].callee = (int)callees[i];
+			records[i].xPos = (unsigned short)xs[i];
+			records[i].yPos = (unsigned short)ys[i];
+			records[i].old = (unsigned short)olds[i];
+			records[i].health = (unsigned short)healths[i];
+			records[i].hunger = (unsigned short)hungers[i];
+			records[i].state = (unsigned char)states[i];
+			records[i].flags = (unsigned char)flags[i];
+		}
+
+		model->setMapSize(getHeight(), getWidth());
+		model->setLastId(getLastId());
+		model->setTick(getTick());
+		model->getRandom().setState(getRandomState());
+		model->loadRecords(records);
+
+		return true;
+	}
+
+	static bool save(Model* model, std::string path)
+	{
+		std::vector<EntityRecord> records = model->getRecords();
+		size_t count = records.size();
+
+		size_t offsets[COLUMN_COUNT];
+		size_t offset = align(HEADER_SIZE + COLUMN_COUNT * COLUMN_ENTRY_SIZE);
+
+		for (int column = 0; column < COLUMN_COUNT; column++)
+		{
+			offsets[column] = offset;
+			offset = align(offset + count * columnWidth(column));
+		}
+
+		std::vector<unsigned char> buffer(offset, 0);
+		unsigned char* out = buffer.data();
+
+		BinaryUtility::writeU32(out, MAGIC);
+		BinaryUtility::writeU32(out + 4, VERSION);
+		BinaryUtility::writeU32(out + 8, (unsigned int)model->getMap()->getHeight());
+		BinaryUtility::writeU32(out + 12, (unsigned int)model->getMap()->getWidth());
+		BinaryUtility::writeU32(out + 16, (unsigned int)model->getLastId());
+		BinaryUtility::writeU32(out + 20, COLUMN_COUNT);
+		BinaryUtility::writeU64(out + 24, (unsigned long long)model->getTick());
+		BinaryUtility::writeU64(out + 32, count);
+		BinaryUtility::writeU64(out + 40, model->getRandom().getState());
+
+		for (int column = 0; column < COLUMN_COUNT; column++)
+		{
+			BinaryUtility::writeU64(out + HEADER_SIZE + column * COLUMN_ENTRY_SIZE, offsets[column]);
+			BinaryUtility::writeU32(out + HEADER_SIZE + column * COLUMN_ENTRY_SIZE + 8, columnWidth(column));
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			BinaryUtility::writeU32(out + offsets[ID] + i * 4, (unsigned int)records[i].id);
+			BinaryUtility::writeU32(out + offsets[TARGET] + i * 4, (unsigned int)records[i].target);
+			BinaryUtility::writeU32(out + offsets[CALLEE] + i * 4, (unsigned int)records[i].callee);
+			BinaryUtility::writeU16(out + offsets[XPOS] + i * 2, records[i].xPos);
+			BinaryUtility::writeU16(out + offsets[YPOS] + i * 2, records[i].yPos);
+			BinaryUtility::writeU16(out + offsets[OLD] + i * 2, records[i].old);
+			BinaryUtility::writeU16(out + offsets[HEALTH] + i * 2, records[i].health);
+			BinaryUtility::writeU16(out + offsets[HUNGER] + i * 2, records[i].hunger);
+			out[offsets[STATE] + i] = records[i].state;
+			out[offsets[FLAGS] + i] = records[i].flags;
+		}
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write((const char*)buffer.data(), buffer.size());
+
+		return (bool)file;
+	}
+};
@@ -1,6 +1,37 @@
 #pragma once
 #include <random>
 
+class RandomEngine
+{
+	unsigned long long state;
+
+public:
+	typedef unsigned long long result_type;
+
+	RandomEngine()
+	{
+		std::random_device rd;
+		state = ((unsigned long long)rd() << 32) | rd();
+	}
+
+	RandomEngine(unsigned long long seed) : state(seed) {}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~0ULL; }
+
+	result_type operator()()
+	{
+		unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+		return z ^ (z >> 31);
+	}
+
+	unsigned long long getState() { return state; }
+	void setState(unsigned long long newState) { state = newState; }
+};
+
 class MathUtility
 {
 public:
@@ -12,4 +43,14 @@ public:
 		
 		return dist(rd);
 	}
+
+	static int randomInt(RandomEngine& engine, int from, int to)
+	{
+		if (to <= from)
+			return from;
+
+		unsigned long long range = (unsigned long long)((long long)to - from) + 1;
+
+		return from + (int)(engine() % range);
+	}
 };
@@ -1,7 +1,24 @@
 #pragma once
 #include <set>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <fstream>
+#include <sstream>
+#include <charconv>
+#include <cstring>
+#include <functional>
+#include <algorithm>
 #include "SetUtility.h"
+#include "MathUtility.h"
+#include "BinaryUtility.h"
+#include "EntityRecord.h"
 #include "Map.h"
+#include "BlockCounts.h"
+#include "Region.h"
+#include "EntityQuery.h"
+#include "Census.h"
+#include "PopulationStats.h"
 #include "Entity.h"
 #include "Animal.h"
 #include "Plant.h"
@@ -10,21 +27,81 @@
 class Model
 {
 	int lastId;
+	long long tick;
 	Map map;
-	std::set<Entity*> entities;
+	BlockCounts blocks;
+	BlockCounts males;
+	Census census;
+	PopulationStats population;
+	std::set<Entity*, EntityIdLess> entities;
+	RandomEngine random;
+	std::vector<std::function<void(Model*)>> tickListeners;
 
 public:
-	Model(Model& another)
+	static const unsigned int BINARY_MAGIC = 0x57594144;
+	static const unsigned int BINARY_VERSION = 1;
+	static const int BINARY_HEADER_SIZE = 48;
+	static const int BINARY_CHECKSUM_SIZE = 8;
+
+	static const int TEXT_BUFFER_SIZE = 1 << 16;
+	static const int TEXT_LINE_MAX_SIZE = 13 * 24;
+
+	Model(Model& another) : map(another.map), blocks(another.blocks), males(another.males), census(another.census), population(another.population), random(another.random)
 	{
 		lastId = another.lastId;
-		map = another.map;
-		entities = std::set<Entity*>(another.entities);
+		tick = another.tick;
+
+		std::unordered_map<Entity*, Entity*> clones;
+		clones.reserve(another.entities.size());
+
+		for (Entity* entity : another.entities)
+		{
+			Entity* clone = entity->clone();
+
+			clones[entity] = clone;
+			entities.insert(entities.end(), clone);
+		}
+
+		for (auto& pair : clones)
+		{
+			auto target = clones.find(pair.first->getTarget());
+			auto callee = clones.find(pair.first->getCallee());
+
+			pair.second->setTarget(target != clones.end() ? target->second : nullptr);
+			pair.second->setCallee(callee != clones.end() ? callee->second : nullptr);
+		}
+	}
+
+	Model& operator=(const Model&) = delete;
+
+	~Model()
+	{
+		clearEntities();
+	}
+
+	Model* fork()
+	{
+		return new Model(*this);
 	}
 
-	Model(int mapHeight, int mapWidth): map(mapHeight, mapWidth)
+	Model(int mapHeight, int mapWidth): map(mapHeight, mapWidth), blocks(mapHeight, mapWidth), males(mapHeight, mapWidth)
 	{
 		lastId = 0;
+		tick = 0;
 
+		populate();
+	}
+
+	Model(int mapHeight, int mapWidth, unsigned long long seed): map(mapHeight, mapWidth), blocks(mapHeight, mapWidth), males(mapHeight, mapWidth), random(seed)
+	{
+		lastId = 0;
+		tick = 0;
+
+		populate();
+	}
+
+	void populate()
+	{
 		// initialize entities
 
 		const int INITIAL_PLANTEATING_MALE_COUNT = 3;
@@ -38,7 +115,7 @@ public:
 
 		for (int i = 0; i < INITIAL_PLANTEATING_MALE_COUNT; i++)
 		{
-			Position pos = SetUtility::randomFrom(free);
+			Position pos = SetUtility::randomFrom(free, random);
 
 			addPlantEatingMale(pos);
 
@@ -47,7 +124,7 @@ public:
 
 		for (int i = 0; i < INITIAL_PLANTEATING_FEMALE_COUNT; i++)
 		{
-			Position pos = SetUtility::randomFrom(free);
+			Position pos = SetUtility::randomFrom(free, random);
 
 			addPlantEatingFemale(pos);
 
@@ -56,7 +133,7 @@ public:
 
 		for (int i = 0; i < INITIAL_PREDATORS_MALE_COUNT; i++)
 		{
-			Position pos = SetUtility::randomFrom(free);
+			Position pos = SetUtility::randomFrom(free, random);
 
 			addPredatorMale(pos);
 
@@ -65,7 +142,7 @@ public:
 
 		for (int i = 0; i < INITIAL_PREDATORS_FEMALE_COUNT; i++)
 		{
-			Position pos = SetUtility::randomFrom(free);
+			Position pos = SetUtility::randomFrom(free, random);
 
 			addPredatorFemale(pos);
 
@@ -74,7 +151,7 @@ public:
 
 		for (int i = 0; i < INITIAL_PLANTS_COUNT; i++)
 		{
-			Position pos = SetUtility::randomFrom(free);
+			Position pos = SetUtility::randomFrom(free, random);
 
 			addPlant(pos);
 
@@ -83,7 +160,7 @@ public:
 
 		for (int i = 0; i < INITIAL_FOOD_COUNT; i++)
 		{
-			Position pos = SetUtility::randomFrom(free);
+			Position pos = SetUtility::randomFrom(free, random);
 
 			addFood(pos);
 
@@ -92,245 +169,669 @@ public:
 	}
 
 	Map* getMap() { return &map; }
-	std::set<Entity*>& getEntities() { return entities; }
+	BlockCounts* getBlockCounts() { return &blocks; }
+	BlockCounts* getMaleCounts() { return &males; }
+	PopulationStats* getPopulation() { return &population; }
 
+	// Entity objects plus the id-ordered set's nodes, each a value and three links with a colour
+	size_t getEntityStoreBytes()
+	{
+		size_t animals = (size_t)(population.getKindCount(BlockCounts::PLANT_EATING) + population.getKindCount(BlockCounts::PREDATOR));
+		size_t plants = (size_t)population.getKindCount(BlockCounts::PLANT);
+		size_t food = (size_t)population.getKindCount(BlockCounts::FOOD);
 
-	std::string getSerealization()
+		return animals * sizeof(Animal) + plants * sizeof(Plant) + food * sizeof(Food) + entities.size() * (sizeof(Entity*) + 4 * sizeof(void*));
+	}
+
+	Census* getCensus() { return &census; }
+	std::set<Entity*, EntityIdLess>& getEntities() { return entities; }
+	RandomEngine& getRandom() { return random; }
+
+	int getLastId() { return lastId; }
+	void setLastId(int id) { lastId = id; }
+
+	long long getTick() { return tick; }
+	void setTick(long long newTick) { tick = newTick; }
+
+	void nextTick()
+	{
+		tick++;
+
+		for (auto& listener : tickListeners)
+			listener(this);
+	}
+
+	void addTickListener(std::function<void(Model*)> listener)
 	{
-		std::string result = "";
+		tickListeners.push_back(listener);
+	}
 
-		result += std::to_string(lastId);
-		result += std::string(" ");
+	void setMapSize(int mapHeight, int mapWidth)
+	{
+		if (mapHeight == map.getHeight() && mapWidth == map.getWidth())
+			return;
 
-		result += std::to_string(map.getHeight());
-		result += std::string(" ");
+		map = Map(mapHeight, mapWidth);
+		blocks.resize(mapHeight, mapWidth);
+		males.resize(mapHeight, mapWidth);
 
-		result += std::to_string(map.getWidth());
-		result += std::string("\n");
+		for (Entity* entity : entities)
+			countEntity(entity, 1);
+	}
 
+	void clearEntities()
+	{
 		for (Entity* entity : entities)
-			result += getSerealizationOfEntity(entity);
+			delete entity;
 
-		return result;
+		entities.clear();
+		blocks.clear();
+		males.clear();
+		population.clear();
+		census.clear();
 	}
 
-	void deserealizeRepresentation(std::string representation)
+	void countEntity(Entity* entity, int delta)
 	{
-		std::stringstream ss(representation);
+		BlockCounts::Kind kind = BlockCounts::kindOf(entity);
 
-		std::string line;
+		blocks.add(entity->getPosition(), kind, delta);
 
-		std::getline(ss, line);
+		if (entity->isAnimal() && entity->isMale())
+			males.add(entity->getPosition(), kind, delta);
+	}
 
-		std::stringstream inner(line);
+	// Keeps the population stats and census in step with every insert, removal and value change
+	void tally(Entity* entity, int delta)
+	{
+		population.add(entity, delta);
+		census.add(entity, delta);
+	}
 
-		inner >> lastId;
-		
-		int heightSize;
-		int widthSize;
+	void insertEntity(Entity* entity)
+	{
+		entities.insert(entity);
+		countEntity(entity, 1);
+		tally(entity, 1);
+	}
 
-		inner >> heightSize;
-		inner >> widthSize;
+	void removeEntity(Entity* entity)
+	{
+		if (entities.erase(entity))
+		{
+			countEntity(entity, -1);
+			tally(entity, -1);
+		}
+	}
 
-		map = Map(heightSize, widthSize);
+	// Erases and deletes every victim, dropping survivors' references to them in a single pass
+	int removeEntities(const std::unordered_set<Entity*>& victims)
+	{
+		if (victims.empty())
+			return 0;
 
-		std::set<Entity*> newEntities;
+		int removed = 0;
 
-		while (true)
+		for (auto it = entities.begin(); it != entities.end();)
 		{
-			std::getline(ss, line);
+			Entity* entity = *it;
 
-			if (line.empty())
-				break;
+			if (victims.count(entity))
+			{
+				countEntity(entity, -1);
+				tally(entity, -1);
+				it = entities.erase(it);
+				delete entity;
+				removed++;
+				continue;
+			}
 
-			Entity* ent = getDeserealization(line);
+			if (entity->getTarget() && victims.count(entity->getTarget()))
+				entity->setTarget(nullptr);
 
-			newEntities.insert(ent);
+			if (entity->getCallee() && victims.count(entity->getCallee()))
+				entity->setCallee(nullptr);
+
+			++it;
 		}
 
-		ss = std::stringstream(representation);
-		
-		std::string ignore;
+		return removed;
+	}
+
+	void getInRegion(const Region& region, std::vector<Entity*>& found)
+	{
+		for (Entity* entity : entities)
+			if (region.contains(entity->getPosition()))
+				found.push_back(entity);
+	}
 
-		std::getline(ss, ignore);
+	// State and value changes go through these so the population stats and census stay current
+	void changeState(Entity* entity, EntityState state)
+	{
+		tally(entity, -1);
+		entity->setState(state);
+		tally(entity, 1);
+	}
 
-		while (true)
+	void changeHealth(Entity* entity, int health)
+	{
+		tally(entity, -1);
+		entity->setHealth(health);
+		tally(entity, 1);
+	}
+
+	void changeHunger(Entity* entity, int hunger)
+	{
+		tally(entity, -1);
+		entity->setHunger(hunger);
+		tally(entity, 1);
+	}
+
+	void changeOld(Entity* entity, int old)
+	{
+		tally(entity, -1);
+		entity->setOld(old);
+		tally(entity, 1);
+	}
+
+	void moveEntity(Entity* entity, Position to)
+	{
+		countEntity(entity, -1);
+		entity->setPosition(to);
+		countEntity(entity, 1);
+	}
+
+	size_t getBinarySize()
+	{
+		return BINARY_HEADER_SIZE + entities.size() * EntityRecord::SIZE + BINARY_CHECKSUM_SIZE;
+	}
+
+	void saveBinary(std::vector<unsigned char>& buffer)
+	{
+		buffer.resize(getBinarySize());
+
+		saveBinary(buffer.data());
+	}
+
+	void saveBinary(unsigned char* out)
+	{
+		writeBinaryHeader(out, map.getHeight(), map.getWidth(), lastId, tick, entities.size(), random.getState());
+
+		unsigned char* current = out + BINARY_HEADER_SIZE;
+
+		for (Entity* entity : entities)
 		{
-			std::getline(ss, line);
+			EntityRecord::fromEntity(entity).write(current);
+			current += EntityRecord::SIZE;
+		}
 
-			if (line.empty())
-				break;
+		BinaryUtility::writeU64(current, BinaryUtility::checksum(out, current - out));
+	}
+
+	static void saveBinary(std::vector<unsigned char>& buffer, int height, int width, int lastId, long long tick,
+		unsigned long long randomState, const std::vector<EntityRecord>& records)
+	{
+		buffer.resize(BINARY_HEADER_SIZE + records.size() * EntityRecord::SIZE + BINARY_CHECKSUM_SIZE);
 
-			extractTargetAndCallee(line);
+		unsigned char* out = buffer.data();
+		writeBinaryHeader(out, height, width, lastId, tick, records.size(), randomState);
+
+		unsigned char* current = out + BINARY_HEADER_SIZE;
+
+		for (const EntityRecord& record : records)
+		{
+			record.write(current);
+			current += EntityRecord::SIZE;
 		}
 
-		entities = newEntities;
+		BinaryUtility::writeU64(current, BinaryUtility::checksum(out, current - out));
 	}
 
-	Entity* getDeserealization(std::string serealizationLine)
+	static void writeBinaryHeader(unsigned char* out, int height, int width, int lastId, long long tick,
+		unsigned long long count, unsigned long long randomState)
 	{
-		std::stringstream ss(serealizationLine);
+		BinaryUtility::writeU32(out, BINARY_MAGIC);
+		BinaryUtility::writeU32(out + 4, BINARY_VERSION);
+		BinaryUtility::writeU32(out + 8, (unsigned int)height);
+		BinaryUtility::writeU32(out + 12, (unsigned int)width);
+		BinaryUtility::writeU32(out + 16, (unsigned int)lastId);
+		BinaryUtility::writeU32(out + 20, 0);
+		BinaryUtility::writeU64(out + 24, (unsigned long long)tick);
+		BinaryUtility::writeU64(out + 32, count);
+		BinaryUtility::writeU64(out + 40, randomState);
+	}
 
-		int id;
-		int old;
-		int health;
-		int hunger;
-		bool active;
-		bool male;
-		bool predator;
+	bool loadBinary(const unsigned char* data, size_t size)
+	{
+		if (size < BINARY_HEADER_SIZE + BINARY_CHECKSUM_SIZE)
+			return false;
 
-		int state;
+		if (BinaryUtility::readU32(data) != BINARY_MAGIC || BinaryUtility::readU32(data + 4) != BINARY_VERSION)
+			return false;
 
-		int target;
-		int callee;
+		unsigned long long count = BinaryUtility::readU64(data + 32);
 
-		int xPos;
-		int yPos;
+		if (count > (size - BINARY_HEADER_SIZE - BINARY_CHECKSUM_SIZE) / EntityRecord::SIZE
+			|| BINARY_HEADER_SIZE + count * EntityRecord::SIZE + BINARY_CHECKSUM_SIZE != size)
+			return false;
 
-		int type;
+		size_t checksumOffset = size - BINARY_CHECKSUM_SIZE;
 
-		ss >> id;
-		ss >> old;
-		ss >> health;
-		ss >> hunger;
-		ss >> active;
-		ss >> male;
-		ss >> predator;
-		ss >> state;
-		ss >> target;
-		ss >> callee;
-		ss >> xPos;
-		ss >> yPos;
-		ss >> type;
+		if (BinaryUtility::readU64(data + checksumOffset) != BinaryUtility::checksum(data, checksumOffset))
+			return false;
 
-		Entity* result = nullptr;
+		setMapSize((int)BinaryUtility::readU32(data + 8), (int)BinaryUtility::readU32(data + 12));
 
-		if (type == 0)
-			result = new Animal(id, predator, old, health, hunger, active, male, Position(xPos, yPos));
+		lastId = (int)BinaryUtility::readU32(data + 16);
+		tick = (long long)BinaryUtility::readU64(data + 24);
+		random.setState(BinaryUtility::readU64(data + 40));
 
-		else if (type == 1)
-			result = new Plant(id, old, health, hunger, active, Position(xPos, yPos));
+		std::vector<EntityRecord> records((size_t)count);
 
-		else if (type == 2)
-			result = new Food(id, old, health, hunger, active, Position(xPos, yPos));
+		for (size_t i = 0; i < records.size(); i++)
+			records[i] = EntityRecord::read(data + BINARY_HEADER_SIZE + i * EntityRecord::SIZE);
 
-		return result;
+		loadRecords(records);
+
+		return true;
 	}
 
-	void extractTargetAndCallee(std::string serealizationLine)
+	std::vector<EntityRecord> getRecords()
 	{
-		std::stringstream ss(serealizationLine);
+		std::vector<EntityRecord> records;
+		records.reserve(entities.size());
 
-		int id;
-		int old;
-		int health;
-		int hunger;
-		bool active;
-		bool male;
-		bool predator;
+		for (Entity* entity : entities)
+			records.push_back(EntityRecord::fromEntity(entity));
 
-		int state;
+		return records;
+	}
 
-		int target;
-		int callee;
+	void getRecords(std::vector<EntityRecord>& records)
+	{
+		records.resize(entities.size());
 
-		int xPos;
-		int yPos;
+		size_t i = 0;
+		for (Entity* entity : entities)
+			records[i++] = EntityRecord::fromEntity(entity);
+	}
 
-		int type;
+	int query(const EntityQuery& query, std::vector<EntityRecord>& page)
+	{
+		page.clear();
 
-		ss >> id;
-		ss >> old;
-		ss >> health;
-		ss >> hunger;
-		ss >> active;
-		ss >> male;
-		ss >> predator;
-		ss >> state;
-		ss >> target;
-		ss >> callee;
-		ss >> xPos;
-		ss >> yPos;
-		ss >> type;
+		size_t offset = std::max(0, query.offset);
+		size_t limit = std::max(0, query.limit);
 
-		Entity* entity = getById(id);
+		if (query.isUnfiltered() && query.sortColumn == EntityQuery::BY_ID)
+		{
+			if (query.descending)
+				collectPage(entities.rbegin(), entities.rend(), offset, limit, page);
 
-		if (!entity)
-			return;
+			else
+				collectPage(entities.begin(), entities.end(), offset, limit, page);
+
+			return (int)entities.size();
+		}
+
+		std::vector<std::pair<long long, Entity*>> matched;
+
+		for (Entity* entity : entities)
+			if (query.matches(entity))
+				matched.push_back(std::make_pair(query.keyOf(entity), entity));
+
+		size_t end = std::min(matched.size(), offset + limit);
+
+		if (offset < end)
+		{
+			bool descending = query.descending;
+
+			std::partial_sort(matched.begin(), matched.begin() + end, matched.end(),
+				[descending](const std::pair<long long, Entity*>& a, const std::pair<long long, Entity*>& b)
+				{
+					if (a.first != b.first)
+						return descending ? a.first > b.first : a.first < b.first;
+
+					return a.second->getId() < b.second->getId();
+				}
+			);
+
+			for (size_t i = offset; i < end; i++)
+				page.push_back(EntityRecord::fromEntity(matched[i].second));
+		}
 
-		entity->setTarget(getById(target));
-		entity->setCallee(getById(callee));
+		return (int)matched.size();
 	}
 
-	std::string getSerealizationOfEntity(Entity* ent)
+	template<typename Iterator>
+	static void collectPage(Iterator from, Iterator to, size_t offset, size_t limit, std::vector<EntityRecord>& page)
+	{
+		for (size_t skipped = 0; from != to && skipped < offset; skipped++)
+			++from;
+
+		for (; from != to && page.size() < limit; ++from)
+			page.push_back(EntityRecord::fromEntity(*from));
+	}
+
+	void loadRecords(const std::vector<EntityRecord>& records)
+	{
+		clearEntities();
+
+		std::unordered_map<int, Entity*> byId;
+		byId.reserve(records.size());
+
+		for (const EntityRecord& record : records)
+		{
+			Entity* entity = record.toEntity();
+
+			if (!entity)
+				continue;
+
+			byId[entity->getId()] = entity;
+			insertEntity(entity);
+		}
+
+		for (const EntityRecord& record : records)
+		{
+			auto entity = byId.find(record.id);
+
+			if (entity == byId.end())
+				continue;
+
+			auto target = byId.find(record.target);
+			auto callee = byId.find(record.callee);
+
+			entity->second->setTarget(target != byId.end() ? target->second : nullptr);
+			entity->second->setCallee(callee != byId.end() ? callee->second : nullptr);
+		}
+	}
+
+	bool saveBinaryToFile(std::string path)
+	{
+		std::vector<unsigned char> buffer;
+		saveBinary(buffer);
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write((const char*)buffer.data(), buffer.size());
+
+		return (bool)file;
+	}
+
+	bool loadBinaryFromFile(std::string path)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+		if (!file)
+			return false;
+
+		std::vector<unsigned char> buffer((size_t)file.tellg());
+
+		file.seekg(0);
+		file.read((char*)buffer.data(), buffer.size());
+
+		if (!file)
+			return false;
+
+		return loadBinary(buffer.data(), buffer.size());
+	}
+
+
+	std::string getSerealization()
+	{
+		std::ostringstream result;
+
+		serialize(result);
+
+		return result.str();
+	}
+
+	void serialize(std::ostream& out)
+	{
+		char buffer[TEXT_BUFFER_SIZE];
+		char* current = buffer;
+
+		current = writeNumber(current, lastId, ' ');
+		current = writeNumber(current, map.getHeight(), ' ');
+		current = writeNumber(current, map.getWidth(), '\n');
+
+		for (Entity* entity : entities)
+		{
+			if (buffer + TEXT_BUFFER_SIZE - current < TEXT_LINE_MAX_SIZE)
+			{
+				out.write(buffer, current - buffer);
+				current = buffer;
+			}
+
+			current = writeSerealizationOfEntity(current, entity);
+		}
+
+		out.write(buffer, current - buffer);
+	}
+
+	void deserealizeRepresentation(std::string representation)
 	{
-		std::string result = "";
+		std::istringstream ss(representation);
 
-		result += std::to_string(ent->getId());
-		result += std::string(" ");
+		deserialize(ss);
+	}
 
-		result += std::to_string(ent->getOld());
-		result += std::string(" ");
+	bool deserialize(std::istream& in)
+	{
+		char buffer[TEXT_BUFFER_SIZE];
+		size_t begin = 0;
+		size_t end = 0;
 
-		result += std::to_string(ent->getHealth());
-		result += std::string(" ");
+		std::set<Entity*, EntityIdLess> newEntities;
+		std::unordered_map<int, Entity*> byId;
+		std::vector<std::pair<int, std::pair<int, int>>> links;
 
-		result += std::to_string(ent->getHunger());
-		result += std::string(" ");
+		int newLastId = 0;
+		int heightSize = 0;
+		int widthSize = 0;
 
-		result += std::to_string(ent->isActive());
-		result += std::string(" ");
+		bool headerIsRead = false;
+		bool failed = false;
 
-		result += std::to_string(ent->isMale());
-		result += std::string(" ");
+		while (!failed)
+		{
+			char* lineEnd = (char*)std::memchr(buffer + begin, '\n', end - begin);
 
-		result += std::to_string(ent->isPredator());
-		result += std::string(" ");
+			if (!lineEnd)
+			{
+				std::memmove(buffer, buffer + begin, end - begin);
+				end -= begin;
+				begin = 0;
+
+				if (end == TEXT_BUFFER_SIZE)
+				{
+					failed = true;
+					break;
+				}
+
+				in.read(buffer + end, TEXT_BUFFER_SIZE - end);
+				size_t read = (size_t)in.gcount();
+
+				if (read > 0)
+				{
+					end += read;
+					continue;
+				}
+
+				lineEnd = buffer + end;
+			}
 
-		result += std::to_string(ent->getState());
-		result += std::string(" ");
+			const char* line = buffer + begin;
+			const char* lineLast = lineEnd;
 
-		/*std::stringstream ss;
-		ss << ent->getTarget();
+			if (lineLast > line && lineLast[-1] == '\r')
+				lineLast--;
 
-		result += ss.str();
-		result += std::string(" ");
+			begin = lineEnd - buffer + (lineEnd < buffer + end ? 1 : 0);
 
-		ss = std::stringstream();
-		ss << ent->getCallee();*/
+			if (!headerIsRead)
+			{
+				headerIsRead = true;
 
-		if (ent->getTarget())
-			result += std::to_string(ent->getTarget()->getId());
+				int header[3];
 
-		else
-			result += std::to_string(-1);
-		result += std::string(" ");
+				failed = !readNumbers(line, lineLast, header, 3);
 
+				newLastId = header[0];
+				heightSize = header[1];
+				widthSize = header[2];
 
-		if (ent->getCallee())
-			result += std::to_string(ent->getCallee()->getId());
+				continue;
+			}
 
-		else
-			result += std::to_string(-1);
+			if (line == lineLast)
+				break;
 
-		result += std::string(" ");
+			int fields[13];
 
-		result += std::to_string(ent->getPosition().getX());
-		result += std::string(" ");
+			if (!readNumbers(line, lineLast, fields, 13))
+			{
+				failed = true;
+				break;
+			}
+
+			Entity* entity = createFromFields(fields);
+
+			if (!entity)
+				continue;
+
+			if (!newEntities.insert(entity).second)
+			{
+				delete entity;
+				failed = true;
+				break;
+			}
+
+			byId[entity->getId()] = entity;
+			links.push_back(std::make_pair(fields[0], std::make_pair(fields[8], fields[9])));
+		}
+
+		if (failed || !headerIsRead)
+		{
+			for (Entity* entity : newEntities)
+				delete entity;
+
+			return false;
+		}
+
+		for (auto& link : links)
+		{
+			Entity* entity = byId[link.first];
 
-		result += std::to_string(ent->getPosition().getY());
-		result += std::string(" ");
+			auto target = byId.find(link.second.first);
+			auto callee = byId.find(link.second.second);
+
+			entity->setTarget(target != byId.end() ? target->second : nullptr);
+			entity->setCallee(callee != byId.end() ? callee->second : nullptr);
+		}
+
+		lastId = newLastId;
+		setMapSize(heightSize, widthSize);
+
+		clearEntities();
+		entities = newEntities;
+
+		for (Entity* entity : entities)
+		{
+			countEntity(entity, 1);
+			tally(entity, 1);
+		}
+
+		return true;
+	}
+
+	Entity* getDeserealization(std::string serealizationLine)
+	{
+		int fields[13];
+
+		if (!readNumbers(serealizationLine.data(), serealizationLine.data() + serealizationLine.size(), fields, 13))
+			return nullptr;
+
+		return createFromFields(fields);
+	}
+
+	std::string getSerealizationOfEntity(Entity* ent)
+	{
+		char buffer[TEXT_LINE_MAX_SIZE];
+
+		return std::string(buffer, writeSerealizationOfEntity(buffer, ent));
+	}
+
+	static char* writeNumber(char* out, long long value, char separator)
+	{
+		out = std::to_chars(out, out + 24, value).ptr;
+		*out++ = separator;
+
+		return out;
+	}
+
+	static char* writeSerealizationOfEntity(char* out, Entity* ent)
+	{
+		out = writeNumber(out, ent->getId(), ' ');
+		out = writeNumber(out, ent->getOld(), ' ');
+		out = writeNumber(out, ent->getHealth(), ' ');
+		out = writeNumber(out, ent->getHunger(), ' ');
+		out = writeNumber(out, ent->isActive(), ' ');
+		out = writeNumber(out, ent->isMale(), ' ');
+		out = writeNumber(out, ent->isPredator(), ' ');
+		out = writeNumber(out, ent->getState(), ' ');
+		out = writeNumber(out, ent->getTarget() ? ent->getTarget()->getId() : -1, ' ');
+		out = writeNumber(out, ent->getCallee() ? ent->getCallee()->getId() : -1, ' ');
+		out = writeNumber(out, ent->getPosition().getX(), ' ');
+		out = writeNumber(out, ent->getPosition().getY(), ' ');
 
 		if (ent->isAnimal())
-			result += std::to_string(0);
+			*out++ = '0';
 
 		else if (ent->isPlant())
-			result += std::to_string(1);
+			*out++ = '1';
 
 		else if (ent->isFood())
-			result += std::to_string(2);
+			*out++ = '2';
+
+		*out++ = '\n';
+
+		return out;
+	}
+
+	static bool readNumbers(const char* from, const char* to, int* numbers, int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			while (from < to && *from == ' ')
+				from++;
+
+			std::from_chars_result parsed = std::from_chars(from, to, numbers[i]);
 
-		result += "\n";
+			if (parsed.ec != std::errc())
+				return false;
+
+			from = parsed.ptr;
+		}
+
+		return true;
+	}
+
+	static Entity* createFromFields(int* fields)
+	{
+		Entity* result = nullptr;
+		Position pos(fields[10], fields[11]);
+
+		if (fields[12] == 0)
+			result = new Animal(fields[0], fields[6], fields[1], fields[2], fields[3], fields[4], fields[5], pos);
+
+		else if (fields[12] == 1)
+			result = new Plant(fields[0], fields[1], fields[2], fields[3], fields[4], pos);
+
+		else if (fields[12] == 2)
+			result = new Food(fields[0], fields[1], fields[2], fields[3], fields[4], pos);
+
+		if (result)
+			result->setState((EntityState)fields[7]);
 
 		return result;
 	}
@@ -382,7 +883,10 @@ public:
 			else if (!closest)
 				closest = entity;
 
-			if (closest->getPosition().difference(to->getPosition()) > entity->getPosition().difference(to->getPosition()))
+			int closestDistance = closest->getPosition().difference(to->getPosition());
+			int distance = entity->getPosition().difference(to->getPosition());
+
+			if (closestDistance > distance || (closestDistance == distance && entity->getId() < closest->getId()))
 				closest = entity;
 		}
 
@@ -544,7 +1048,7 @@ public:
 
 	bool isFree(Position pos)
 	{
-		return ! SetUtility::isIn(getNonFreePositions(), pos);
+		return map.isValid(pos) && blocks.countAt(pos) == 0;
 	}
 
 	Entity* getIn(Position pos)
@@ -583,98 +1087,89 @@ public:
 
 	void bornNewPlantEatingFemale(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Animal(lastId++, 0, 0, 15, 0, false, false, pos));
+		if (isFree(pos))
+		{
+			insertEntity(new Animal(lastId++, 0, 0, 15, 0, false, false, pos));
+			population.countBirth();
+		}
 	}
 
 	void addEntity(Entity* ent)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, ent->getPosition()))
-			entities.insert(ent);
+		if (isFree(ent->getPosition()))
+			insertEntity(ent);
 	}
 
 	void bornNewPlantEatingMale(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Animal(lastId++, 0, 0, 15, 0, false, true, pos));
+		if (isFree(pos))
+		{
+			insertEntity(new Animal(lastId++, 0, 0, 15, 0, false, true, pos));
+			population.countBirth();
+		}
 	}
 
 	void bornNewPredatorFemale(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Animal(lastId++, true, 0, 15, 0, false, false, pos));
+		if (isFree(pos))
+		{
+			insertEntity(new Animal(lastId++, true, 0, 15, 0, false, false, pos));
+			population.countBirth();
+		}
 	}
 
 	void bornNewPredatorMale(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Animal(lastId++, true, 0, 15, 0, false, true, pos));
+		if (isFree(pos))
+		{
+			insertEntity(new Animal(lastId++, true, 0, 15, 0, false, true, pos));
+			population.countBirth();
+		}
 	}
 
 	void addPlantEatingMale(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Animal(lastId++, false, 0, 15, 0, true, true, pos));
+		if (isFree(pos))
+			insertEntity(new Animal(lastId++, false, 0, 15, 0, true, true, pos));
 	}
 
 	void addPlantEatingFemale(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Animal(lastId++, 0, 0, 15, 0, true, false, pos));
+		if (isFree(pos))
+			insertEntity(new Animal(lastId++, 0, 0, 15, 0, true, false, pos));
 	}
 
 	void addPredatorMale(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Animal(lastId++, true, 0, 15, 0, true, true, pos));
+		if (isFree(pos))
+			insertEntity(new Animal(lastId++, true, 0, 15, 0, true, true, pos));
 	}
 
 	void addPredatorFemale(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Animal(lastId++, true, 0, 15, 0, true, false, pos));
+		if (isFree(pos))
+			insertEntity(new Animal(lastId++, true, 0, 15, 0, true, false, pos));
 	}
 
 	void bornNewPlant(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Plant(lastId++, 0, 15, 0, false, pos));
+		if (isFree(pos))
+		{
+			insertEntity(new Plant(lastId++, 0, 15, 0, false, pos));
+			population.countBirth();
+		}
 	}
 
 	void addPlant(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Plant(lastId++, 0, 15, 0, true, pos));
+		if (isFree(pos))
+			insertEntity(new Plant(lastId++, 0, 15, 0, true, pos));
 	}
 
 	void addFood(Position pos)
 	{
-		std::set<Position> nonFreePositions = getNonFreePositions();
-
-		if (!SetUtility::isIn(nonFreePositions, pos))
-			entities.insert(new Food(lastId++, 0, 15, 0, true, pos));
+		if (isFree(pos))
+			insertEntity(new Food(lastId++, 0, 15, 0, true, pos));
 	}
 
 	int getDangerLevel(Position pos)
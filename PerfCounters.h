@@ -0,0 +1,256 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "BlockCounts.h"
+#include "Profiler.h"
+#include "Model.h"
+
+// Figures published with relaxed stores by the simulation and render threads, so readers never wait on a tick;
+// each figure reads whole, but a set of them may straddle two ticks
+class PerfCounters
+{
+public:
+	static const int WINDOW_TICKS = 100;
+
+private:
+	static constexpr double AVERAGE_WEIGHT = 0.05;
+
+	// Owned by the simulation thread
+	std::chrono::steady_clock::time_point tickStart;
+	std::chrono::steady_clock::time_point lastMark;
+	std::chrono::steady_clock::time_point rateStart;
+	long long rateTicks;
+	long long phaseNanoseconds[PHASE_COUNT];
+	long long windowTicks[WINDOW_TICKS];
+	long long windowPhases[WINDOW_TICKS][PHASE_COUNT];
+	long long windowPhaseSums[PHASE_COUNT];
+	long long windowScratch[WINDOW_TICKS];
+	int windowNext;
+	int windowSize;
+	double averageTick;
+
+	// Phase marks cost two clock reads per entity, so they run only while someone is looking
+	std::atomic<bool> phasesAreTimed;
+
+	std::atomic<long long> ticks;
+	std::atomic<double> ticksPerSecond;
+	std::atomic<long long> lastTickNanoseconds;
+	std::atomic<long long> averageTickNanoseconds;
+	std::atomic<long long> p99TickNanoseconds;
+	std::atomic<long long> kindCounts[BlockCounts::KIND_COUNT];
+	std::atomic<long long> allocationsPerTick;
+	std::atomic<long long> entityStoreBytes;
+	std::atomic<int> slowestPhase;
+	std::atomic<int> slowestPhasePermille;
+
+	// Owned by the render thread
+	std::atomic<long long> lastRenderNanoseconds;
+	std::atomic<long long> averageRenderNanoseconds;
+
+	static long long nanosecondsBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+	{
+		return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+	}
+
+	static long long average(long long value, long long sample)
+	{
+		return value > 0 ? value + (long long)((sample - value) * AVERAGE_WEIGHT) : sample;
+	}
+
+	static double toMilliseconds(long long nanoseconds) { return nanoseconds / 1e6; }
+
+	void publishWindow(long long tickNanoseconds)
+	{
+		if (windowSize == WINDOW_TICKS)
+			for (int phase = 0; phase < PHASE_COUNT; phase++)
+				windowPhaseSums[phase] -= windowPhases[windowNext][phase];
+
+		windowTicks[windowNext] = tickNanoseconds;
+
+		for (int phase = 0; phase < PHASE_COUNT; phase++)
+		{
+			windowPhases[windowNext][phase] = phaseNanoseconds[phase];
+			windowPhaseSums[phase] += phaseNanoseconds[phase];
+		}
+
+		windowNext = (windowNext + 1) % WINDOW_TICKS;
+		windowSize = std::min(windowSize + 1, WINDOW_TICKS);
+
+		std::copy(windowTicks, windowTicks + windowSize, windowScratch);
+
+		int rank = std::max(0, (windowSize * 99 + 99) / 100 - 1);
+		std::nth_element(windowScratch, windowScratch + rank, windowScratch + windowSize);
+		p99TickNanoseconds.store(windowScratch[rank], std::memory_order_relaxed);
+
+		long long total = 0;
+		int slowest = 0;
+
+		for (int phase = 0; phase < PHASE_COUNT; phase++)
+		{
+			total += windowPhaseSums[phase];
+
+			if (windowPhaseSums[phase] > windowPhaseSums[slowest])
+				slowest = phase;
+		}
+
+		slowestPhase.store(windowPhaseSums[slowest] > 0 ? slowest : -1, std::memory_order_relaxed);
+		slowestPhasePermille.store(total > 0 ? (int)(windowPhaseSums[slowest] * 1000 / total) : 0, std::memory_order_relaxed);
+	}
+
+public:
+	PerfCounters() : phasesAreTimed(false)
+	{
+		reset();
+	}
+
+	bool arePhasesTimed() { return phasesAreTimed.load(std::memory_order_relaxed); }
+	void setPhasesTimed(bool areTimed) { phasesAreTimed.store(areTimed, std::memory_order_relaxed); }
+
+	void reset()
+	{
+		rateStart = std::chrono::steady_clock::now();
+		rateTicks = 0;
+		windowNext = 0;
+		windowSize = 0;
+		averageTick = 0;
+
+		std::fill(phaseNanoseconds, phaseNanoseconds + PHASE_COUNT, 0LL);
+		std::fill(windowPhaseSums, windowPhaseSums + PHASE_COUNT, 0LL);
+
+		ticks = 0;
+		ticksPerSecond = 0;
+		lastTickNanoseconds = averageTickNanoseconds = p99TickNanoseconds = 0;
+		allocationsPerTick = -1;
+		entityStoreBytes = 0;
+		slowestPhase = -1;
+		slowestPhasePermille = 0;
+		lastRenderNanoseconds = averageRenderNanoseconds = 0;
+
+		for (auto& count : kindCounts)
+			count = 0;
+	}
+
+	void beginTick()
+	{
+		tickStart = lastMark = std::chrono::steady_clock::now();
+
+		std::fill(phaseNanoseconds, phaseNanoseconds + PHASE_COUNT, 0LL);
+	}
+
+	// Charges the time since the previous mark to a phase
+	void mark(ProfilePhase phase)
+	{
+		auto now = std::chrono::steady_clock::now();
+
+		phaseNanoseconds[phase] += nanosecondsBetween(lastMark, now);
+		lastMark = now;
+	}
+
+	// Allocations are negative when allocation tracking is not compiled in
+	void endTick(Model* model, long long allocations)
+	{
+		auto now = std::chrono::steady_clock::now();
+		long long tickNanoseconds = nanosecondsBetween(tickStart, now);
+
+		lastTickNanoseconds.store(tickNanoseconds, std::memory_order_relaxed);
+		averageTickNanoseconds.store(average(averageTickNanoseconds.load(std::memory_order_relaxed), tickNanoseconds), std::memory_order_relaxed);
+		ticks.store(ticks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		rateTicks++;
+		long long rateNanoseconds = nanosecondsBetween(rateStart, now);
+
+		if (rateNanoseconds >= 1000000000LL)
+		{
+			ticksPerSecond.store(rateTicks * 1e9 / rateNanoseconds, std::memory_order_relaxed);
+			rateTicks = 0;
+			rateStart = now;
+		}
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+			kindCounts[kind].store(model->getPopulation()->getKindCount(kind), std::memory_order_relaxed);
+
+		allocationsPerTick.store(allocations, std::memory_order_relaxed);
+		entityStoreBytes.store((long long)model->getEntityStoreBytes(), std::memory_order_relaxed);
+
+		publishWindow(tickNanoseconds);
+	}
+
+	void recordRender(long long nanoseconds)
+	{
+		lastRenderNanoseconds.store(nanoseconds, std::memory_order_relaxed);
+		averageRenderNanoseconds.store(average(averageRenderNanoseconds.load(std::memory_order_relaxed), nanoseconds), std::memory_order_relaxed);
+	}
+
+	long long getTicks() { return ticks.load(std::memory_order_relaxed); }
+
+	// One line for the overlay under the map
+	std::string getStatusLine()
+	{
+		char allocations[32] = "n/a";
+		long long allocationCount = allocationsPerTick.load(std::memory_order_relaxed);
+
+		if (allocationCount >= 0)
+			std::snprintf(allocations, sizeof(allocations), "%lld", allocationCount);
+
+		int slowest = slowestPhase.load(std::memory_order_relaxed);
+		char line[192];
+
+		std::snprintf(line, sizeof(line), "%.0f tps  tick %.2f/%.2f/%.2f ms  render %.2f ms  @%lld &%lld X%lld *%lld  allocs %s  store %lld KB  slowest %s %d%%",
+			ticksPerSecond.load(std::memory_order_relaxed),
+			toMilliseconds(lastTickNanoseconds.load(std::memory_order_relaxed)),
+			toMilliseconds(averageTickNanoseconds.load(std::memory_order_relaxed)),
+			toMilliseconds(p99TickNanoseconds.load(std::memory_order_relaxed)),
+			toMilliseconds(averageRenderNanoseconds.load(std::memory_order_relaxed)),
+			kindCounts[BlockCounts::PLANT_EATING].load(std::memory_order_relaxed), kindCounts[BlockCounts::PREDATOR].load(std::memory_order_relaxed),
+			kindCounts[BlockCounts::PLANT].load(std::memory_order_relaxed), kindCounts[BlockCounts::FOOD].load(std::memory_order_relaxed),
+			allocations, entityStoreBytes.load(std::memory_order_relaxed) / 1024,
+			slowest >= 0 ? Profiler::getPhaseName(slowest) : "-", slowestPhasePermille.load(std::memory_order_relaxed) / 10);
+
+		return line;
+	}
+
+	void report(std::vector<std::string>& lines)
+	{
+		char line[160];
+		int slowest = slowestPhase.load(std::memory_order_relaxed);
+
+		std::snprintf(line, sizeof(line), "ticks %lld, %.1f ticks/sec", ticks.load(std::memory_order_relaxed), ticksPerSecond.load(std::memory_order_relaxed));
+		lines.push_back(line);
+
+		std::snprintf(line, sizeof(line), "tick last %.3f ms, avg %.3f ms, p99 %.3f ms over the last %d ticks",
+			toMilliseconds(lastTickNanoseconds.load(std::memory_order_relaxed)), toMilliseconds(averageTickNanoseconds.load(std::memory_order_relaxed)),
+			toMilliseconds(p99TickNanoseconds.load(std::memory_order_relaxed)), WINDOW_TICKS);
+		lines.push_back(line);
+
+		std::snprintf(line, sizeof(line), "render last %.3f ms, avg %.3f ms",
+			toMilliseconds(lastRenderNanoseconds.load(std::memory_order_relaxed)), toMilliseconds(averageRenderNanoseconds.load(std::memory_order_relaxed)));
+		lines.push_back(line);
+
+		std::snprintf(line, sizeof(line), "entities planteating %lld, predator %lld, plant %lld, food %lld",
+			kindCounts[BlockCounts::PLANT_EATING].load(std::memory_order_relaxed), kindCounts[BlockCounts::PREDATOR].load(std::memory_order_relaxed),
+			kindCounts[BlockCounts::PLANT].load(std::memory_order_relaxed), kindCounts[BlockCounts::FOOD].load(std::memory_order_relaxed));
+		lines.push_back(line);
+
+		long long allocationCount = allocationsPerTick.load(std::memory_order_relaxed);
+
+		if (allocationCount >= 0)
+			std::snprintf(line, sizeof(line), "allocations last tick %lld", allocationCount);
+		else
+			std::snprintf(line, sizeof(line), "allocations n/a, rebuild with DAYW_TRACK_ALLOCATIONS defined");
+		lines.push_back(line);
+
+		std::snprintf(line, sizeof(line), "entity store %.1f KB", entityStoreBytes.load(std::memory_order_relaxed) / 1024.0);
+		lines.push_back(line);
+
+		if (slowest < 0 && !arePhasesTimed())
+			std::snprintf(line, sizeof(line), "slowest phase n/a, phases are timed only with the overlay shown or --perf");
+		else
+			std::snprintf(line, sizeof(line), "slowest phase %s, %.1f%% of the last %d ticks",
+				slowest >= 0 ? Profiler::getPhaseName(slowest) : "-", slowestPhasePermille.load(std::memory_order_relaxed) / 10.0, WINDOW_TICKS);
+		lines.push_back(line);
+	}
+};
@@ -11,6 +11,8 @@ public:
 	{
 	}
 
+	virtual Entity* clone() { return new Plant(*this); }
+
 	virtual bool isReproducable()
 	{
 		return old >= 10 && old <= 20;
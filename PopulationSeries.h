@@ -0,0 +1,394 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "BinaryUtility.h"
+#include "BlockCounts.h"
+#include "EntityQuery.h"
+#include "Census.h"
+#include "PopulationStats.h"
+#include "Model.h"
+#include "Tracer.h"
+
+// Samples the delta-maintained population stats each tick into column-major chunks written by a background thread
+class PopulationSeries
+{
+public:
+	enum Format
+	{
+		CSV,
+		BINARY
+	};
+
+	enum ColumnType
+	{
+		INTEGER = 'i',
+		REAL = 'f'
+	};
+
+	static const int CHUNK_ROWS = 4096;
+	static const unsigned long long BINARY_MAGIC = 0x5345495257594144ULL;
+	static const unsigned int BINARY_VERSION = 1;
+
+private:
+	struct Column
+	{
+		std::string name;
+		ColumnType type;
+	};
+
+	struct Chunk
+	{
+		int rows;
+		std::vector<double> values;
+	};
+
+	std::string path;
+	Format format;
+	long long everyTicks;
+	size_t maxQueued;
+	std::vector<Column> columns;
+
+	long long lastBirths;
+	long long lastDeaths;
+	long long lastPredations;
+	bool hasLast;
+
+	Chunk filling;
+	std::deque<Chunk> queued;
+	std::vector<Chunk> spare;
+	bool busy;
+	bool stopping;
+
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::condition_variable idle;
+	std::thread writer;
+	std::ofstream file;
+
+	std::atomic<long long> rowCount;
+	std::atomic<long long> stallCount;
+
+	void addColumn(std::string name, ColumnType type)
+	{
+		Column column;
+		column.name = name;
+		column.type = type;
+
+		columns.push_back(column);
+	}
+
+	void initColumns()
+	{
+		static const char* kindNames[] = { "planteating", "predator", "plant", "food" };
+		static const char* stateNames[] = { "idle", "searchingeat", "eating", "runaway", "waitingpair", "searchingpair", "reproducing", "died" };
+		static const char* metricNames[] = { "old", "health", "hunger" };
+
+		addColumn("tick", INTEGER);
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+			addColumn(kindNames[kind], INTEGER);
+
+		for (int kind = BlockCounts::PLANT_EATING; kind <= BlockCounts::PREDATOR; kind++)
+		{
+			addColumn(std::string(kindNames[kind]) + "_male", INTEGER);
+			addColumn(std::string(kindNames[kind]) + "_female", INTEGER);
+		}
+
+		for (int state = 0; state < EntityQuery::STATE_COUNT; state++)
+			addColumn(stateNames[state], INTEGER);
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+			for (int metric = 0; metric < Census::METRIC_COUNT; metric++)
+			{
+				addColumn(std::string(kindNames[kind]) + "_" + metricNames[metric] + "_mean", REAL);
+				addColumn(std::string(kindNames[kind]) + "_" + metricNames[metric] + "_variance", REAL);
+			}
+
+		addColumn("births", INTEGER);
+		addColumn("deaths", INTEGER);
+		addColumn("predations", INTEGER);
+	}
+
+	void resetChunk(Chunk& chunk)
+	{
+		chunk.rows = 0;
+		chunk.values.resize(columns.size() * CHUNK_ROWS);
+	}
+
+	void writeHeader()
+	{
+		if (format == CSV)
+		{
+			for (size_t i = 0; i < columns.size(); i++)
+				file << (i ? "," : "") << columns[i].name;
+
+			file << "\n";
+			return;
+		}
+
+		// Magic, version and column count, then a type byte, name length byte and name per column
+		std::vector<unsigned char> header(16);
+		BinaryUtility::writeU64(header.data(), BINARY_MAGIC);
+		BinaryUtility::writeU32(header.data() + 8, BINARY_VERSION);
+		BinaryUtility::writeU32(header.data() + 12, (unsigned int)columns.size());
+
+		for (const Column& column : columns)
+		{
+			header.push_back((unsigned char)column.type);
+			header.push_back((unsigned char)column.name.size());
+			header.insert(header.end(), column.name.begin(), column.name.end());
+		}
+
+		file.write((const char*)header.data(), header.size());
+	}
+
+	// Binary chunks are a row count followed by each column's values: int32 or float32, little-endian
+	void writeChunk(const Chunk& chunk, std::vector<unsigned char>& buffer)
+	{
+		if (format == CSV)
+		{
+			char number[32];
+			std::string text;
+
+			for (int row = 0; row < chunk.rows; row++)
+			{
+				for (size_t i = 0; i < columns.size(); i++)
+				{
+					double value = chunk.values[i * CHUNK_ROWS + row];
+
+					if (columns[i].type == INTEGER)
+						std::snprintf(number, sizeof(number), i ? ",%lld" : "%lld", (long long)value);
+					else
+						std::snprintf(number, sizeof(number), i ? ",%.6g" : "%.6g", value);
+
+					text += number;
+				}
+
+				text += "\n";
+			}
+
+			file << text;
+			return;
+		}
+
+		buffer.resize(4 + columns.size() * chunk.rows * 4);
+		BinaryUtility::writeU32(buffer.data(), (unsigned int)chunk.rows);
+
+		unsigned char* out = buffer.data() + 4;
+
+		for (size_t i = 0; i < columns.size(); i++)
+			for (int row = 0; row < chunk.rows; row++, out += 4)
+			{
+				double value = chunk.values[i * CHUNK_ROWS + row];
+
+				if (columns[i].type == INTEGER)
+					BinaryUtility::writeU32(out, (unsigned int)(int)value);
+
+				else
+				{
+					float real = (float)value;
+					unsigned int bits;
+					std::memcpy(&bits, &real, sizeof(bits));
+					BinaryUtility::writeU32(out, bits);
+				}
+			}
+
+		file.write((const char*)buffer.data(), buffer.size());
+	}
+
+	void run()
+	{
+		std::vector<unsigned char> buffer;
+		Chunk writing;
+
+		Tracer::setThreadName("series writer");
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		writeHeader();
+
+		while (true)
+		{
+			wakeUp.wait(lock, [this]() { return !queued.empty() || stopping; });
+
+			if (queued.empty())
+				break;
+
+			std::swap(writing, queued.front());
+			queued.pop_front();
+			busy = true;
+
+			lock.unlock();
+
+			{
+				TRACE_SCOPE("series chunk write");
+				writeChunk(writing, buffer);
+			}
+
+			lock.lock();
+
+			spare.push_back(Chunk());
+			std::swap(spare.back(), writing);
+
+			busy = false;
+			idle.notify_all();
+		}
+
+		file.flush();
+	}
+
+	void submit()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (queued.size() >= maxQueued)
+		{
+			stallCount++;
+			idle.wait(lock, [this]() { return queued.size() < maxQueued; });
+		}
+
+		queued.push_back(Chunk());
+		std::swap(queued.back(), filling);
+		TRACE_COUNTER("series queue", queued.size());
+
+		if (!spare.empty())
+		{
+			std::swap(filling, spare.back());
+			spare.pop_back();
+		}
+
+		lock.unlock();
+		wakeUp.notify_one();
+
+		resetChunk(filling);
+	}
+
+public:
+	PopulationSeries(std::string path, Format format = CSV, long long everyTicks = 1, size_t maxQueued = 4)
+		: path(path), format(format), everyTicks(everyTicks > 0 ? everyTicks : 1), maxQueued(maxQueued > 0 ? maxQueued : 1),
+		lastBirths(0), lastDeaths(0), lastPredations(0), hasLast(false), busy(false), stopping(false), rowCount(0), stallCount(0)
+	{
+		initColumns();
+		resetChunk(filling);
+
+		file.open(path, format == BINARY ? std::ios::binary | std::ios::trunc : std::ios::trunc);
+		writer = std::thread(&PopulationSeries::run, this);
+	}
+
+	~PopulationSeries()
+	{
+		close();
+	}
+
+	bool isOpen() { return file.is_open(); }
+	long long getRowCount() { return rowCount; }
+	long long getStallCount() { return stallCount; }
+
+	void attach(Model* model)
+	{
+		model->addTickListener([this](Model* m)
+			{
+				this->onTick(m);
+			}
+		);
+	}
+
+	void onTick(Model* model)
+	{
+		if (model->getTick() % everyTicks == 0)
+			capture(model);
+	}
+
+	// Constant work per row: every value comes from counters kept by deltas
+	void capture(Model* model)
+	{
+		PopulationStats* stats = model->getPopulation();
+
+		if (!hasLast)
+		{
+			lastBirths = stats->getBirths();
+			lastDeaths = stats->getDeaths();
+			lastPredations = stats->getPredations();
+			hasLast = true;
+		}
+
+		int row = filling.rows;
+		int column = 0;
+
+		auto put = [&](double value)
+		{
+			filling.values[(size_t)column++ * CHUNK_ROWS + row] = value;
+		};
+
+		put((double)model->getTick());
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+			put((double)stats->getKindCount(kind));
+
+		for (int kind = BlockCounts::PLANT_EATING; kind <= BlockCounts::PREDATOR; kind++)
+		{
+			put((double)stats->getMaleCount(kind));
+			put((double)stats->getFemaleCount(kind));
+		}
+
+		for (int state = 0; state < EntityQuery::STATE_COUNT; state++)
+			put((double)stats->getStateCount(state));
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+			for (int metric = 0; metric < Census::METRIC_COUNT; metric++)
+			{
+				put(stats->getMean(kind, metric));
+				put(stats->getVariance(kind, metric));
+			}
+
+		put((double)(stats->getBirths() - lastBirths));
+		put((double)(stats->getDeaths() - lastDeaths));
+		put((double)(stats->getPredations() - lastPredations));
+
+		lastBirths = stats->getBirths();
+		lastDeaths = stats->getDeaths();
+		lastPredations = stats->getPredations();
+
+		filling.rows++;
+		rowCount++;
+
+		if (filling.rows == CHUNK_ROWS)
+			submit();
+	}
+
+	// Hands over the partial chunk and waits until everything captured so far is written
+	void flush()
+	{
+		if (filling.rows)
+			submit();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this]() { return queued.empty() && !busy; });
+	}
+
+	void close()
+	{
+		if (!writer.joinable())
+			return;
+
+		if (filling.rows)
+			submit();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		wakeUp.notify_one();
+		writer.join();
+		file.close();
+	}
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include "Entity.h"
+#include "BlockCounts.h"
+#include "EntityQuery.h"
+#include "Census.h"
+
+// Population counts and value moments kept current by deltas, so reading them never scans the entities
+class PopulationStats
+{
+	long long kindCounts[BlockCounts::KIND_COUNT];
+	long long maleCounts[BlockCounts::KIND_COUNT];
+	long long stateCounts[EntityQuery::STATE_COUNT];
+	long long sums[BlockCounts::KIND_COUNT][Census::METRIC_COUNT];
+	long long squares[BlockCounts::KIND_COUNT][Census::METRIC_COUNT];
+
+	// Cumulative since construction; consumers difference them per tick
+	long long births;
+	long long deaths;
+	long long predations;
+
+public:
+	PopulationStats() : births(0), deaths(0), predations(0)
+	{
+		clear();
+	}
+
+	// Clears the counts of the current population but keeps the event history
+	void clear()
+	{
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+		{
+			kindCounts[kind] = 0;
+			maleCounts[kind] = 0;
+
+			for (int metric = 0; metric < Census::METRIC_COUNT; metric++)
+				sums[kind][metric] = squares[kind][metric] = 0;
+		}
+
+		for (int state = 0; state < EntityQuery::STATE_COUNT; state++)
+			stateCounts[state] = 0;
+	}
+
+	void add(Entity* entity, int delta)
+	{
+		int kind = BlockCounts::kindOf(entity);
+		int state = entity->getState();
+
+		kindCounts[kind] += delta;
+
+		if (entity->isAnimal() && entity->isMale())
+			maleCounts[kind] += delta;
+
+		if (state >= 0 && state < EntityQuery::STATE_COUNT)
+			stateCounts[state] += delta;
+
+		for (int metric = 0; metric < Census::METRIC_COUNT; metric++)
+		{
+			long long value = Census::valueOf(entity, metric);
+
+			sums[kind][metric] += delta * value;
+			squares[kind][metric] += delta * value * value;
+		}
+	}
+
+	void countBirth() { births++; }
+	void countDeath() { deaths++; }
+	void countPredation() { predations++; }
+
+	long long getKindCount(int kind) { return kindCounts[kind]; }
+	long long getMaleCount(int kind) { return maleCounts[kind]; }
+	long long getFemaleCount(int kind) { return kindCounts[kind] - maleCounts[kind]; }
+	long long getStateCount(int state) { return stateCounts[state]; }
+
+	long long getBirths() { return births; }
+	long long getDeaths() { return deaths; }
+	long long getPredations() { return predations; }
+
+	double getMean(int kind, int metric)
+	{
+		return kindCounts[kind] ? (double)sums[kind][metric] / kindCounts[kind] : 0;
+	}
+
+	double getVariance(int kind, int metric)
+	{
+		if (!kindCounts[kind])
+			return 0;
+
+		double mean = getMean(kind, metric);
+		double variance = (double)squares[kind][metric] / kindCounts[kind] - mean * mean;
+
+		return variance > 0 ? variance : 0;
+	}
+};
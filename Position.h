@@ -79,11 +79,11 @@ public:
 
 	bool operator<(Position another)
 	{
-		return getY() * 100 + getX() < another.getY() * 100 + another.getX();
+		return getY() < another.getY() || (getY() == another.getY() && getX() < another.getX());
 	}
 
 	friend bool operator<(Position one, Position another)
 	{
-		return one.getY() * 100 + one.getX() < another.getY() * 100 + another.getX();
+		return one.getY() < another.getY() || (one.getY() == another.getY() && one.getX() < another.getX());
 	}
 };
\ No newline at end of file
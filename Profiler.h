@@ -0,0 +1,324 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <ostream>
+#include "AllocationTracker.h"
+#include "Tracer.h"
+
+// Scopes compile to nothing unless DAYW_PROFILE, DAYW_TRACK_ALLOCATIONS or DAYW_TRACE is defined; timings record only while enabled
+#if defined(DAYW_PROFILE) || defined(DAYW_TRACK_ALLOCATIONS) || defined(DAYW_TRACE)
+#define PROFILE_SCOPE(phase) ProfileScope profileScope(phase)
+#else
+#define PROFILE_SCOPE(phase)
+#endif
+
+enum ProfilePhase
+{
+	PHASE_TICK,
+	PHASE_NEXT_STATE_PLANT_EATING,
+	PHASE_NEXT_STATE_PREDATOR,
+	PHASE_NEXT_STATE_PLANT,
+	PHASE_NEXT_STATE_FOOD,
+	PHASE_ACT_IDLE,
+	PHASE_ACT_SEARCHING_EAT,
+	PHASE_ACT_EATING,
+	PHASE_ACT_RUNAWAY,
+	PHASE_ACT_WAITING_PAIR,
+	PHASE_ACT_SEARCHING_PAIR,
+	PHASE_ACT_REPRODUCING,
+	PHASE_ACT_DIED,
+	PHASE_TARGET_SEARCH,
+	PHASE_MOVEMENT,
+	PHASE_BIRTHS,
+	PHASE_HANDLE_ALL_DIED,
+	PHASE_MAKE_ACTIVE_ALL_BORN,
+	PHASE_RENDER,
+	PHASE_HANDLE_CONSOLE,
+	PHASE_COUNT
+};
+
+// Allocation tags are phases shifted past the untagged slot
+static_assert(PHASE_COUNT + 1 <= AllocationTracker::TAG_COUNT, "too many phases for allocation tags");
+
+// Log-linear buckets of nanoseconds: 8 sub-buckets per power of two, so values read back within 12.5%
+class LatencyHistogram
+{
+public:
+	static const int SUB_BUCKET_BITS = 3;
+	static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+	static const int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+private:
+	// Written only by the owning thread; relaxed atomics let reports read them while it runs
+	std::atomic<unsigned long long> buckets[BUCKET_COUNT];
+	std::atomic<unsigned long long> count;
+	std::atomic<unsigned long long> max;
+
+	static void bump(std::atomic<unsigned long long>& value, unsigned long long delta)
+	{
+		value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+public:
+	LatencyHistogram()
+	{
+		reset();
+	}
+
+	static int bucketOf(unsigned long long value)
+	{
+		if (value < SUB_BUCKET_COUNT)
+			return (int)value;
+
+		int exponent = 63;
+
+		while (!(value >> exponent))
+			exponent--;
+
+		int subBucket = (int)(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+
+		return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + subBucket;
+	}
+
+	static unsigned long long lowestOf(int bucket)
+	{
+		if (bucket < SUB_BUCKET_COUNT)
+			return bucket;
+
+		int exponent = bucket / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+		unsigned long long subBucket = bucket % SUB_BUCKET_COUNT;
+
+		return (SUB_BUCKET_COUNT | subBucket) << (exponent - SUB_BUCKET_BITS);
+	}
+
+	// Reads a percentile back from merged buckets as the upper edge of the bucket holding it
+	static double percentileOf(const std::vector<unsigned long long>& buckets, unsigned long long count, unsigned long long max, double fraction)
+	{
+		unsigned long long rank = (unsigned long long)(fraction * count + 0.5);
+		unsigned long long seen = 0;
+
+		for (int i = 0; i < BUCKET_COUNT; i++)
+		{
+			seen += buckets[i];
+
+			if (seen >= rank && buckets[i])
+				return (double)std::min(lowestOf(i + 1) - 1, max);
+		}
+
+		return (double)max;
+	}
+
+	void record(unsigned long long nanoseconds)
+	{
+		bump(buckets[bucketOf(nanoseconds)], 1);
+		bump(count, 1);
+
+		if (nanoseconds > max.load(std::memory_order_relaxed))
+			max.store(nanoseconds, std::memory_order_relaxed);
+	}
+
+	void reset()
+	{
+		for (auto& bucket : buckets)
+			bucket.store(0, std::memory_order_relaxed);
+
+		count.store(0, std::memory_order_relaxed);
+		max.store(0, std::memory_order_relaxed);
+	}
+
+	void addTo(std::vector<unsigned long long>& total, unsigned long long& totalCount, unsigned long long& totalMax) const
+	{
+		for (int i = 0; i < BUCKET_COUNT; i++)
+			total[i] += buckets[i].load(std::memory_order_relaxed);
+
+		totalCount += count.load(std::memory_order_relaxed);
+		totalMax = std::max(totalMax, max.load(std::memory_order_relaxed));
+	}
+};
+
+class Profiler
+{
+	struct ThreadHistograms
+	{
+		LatencyHistogram phases[PHASE_COUNT];
+	};
+
+	static std::atomic<bool> enabled;
+	static std::mutex threadsMutex;
+	static std::vector<std::shared_ptr<ThreadHistograms>> threads;
+
+	static ThreadHistograms& getThreadHistograms()
+	{
+		thread_local std::shared_ptr<ThreadHistograms> histograms;
+
+		if (!histograms)
+		{
+			histograms = std::make_shared<ThreadHistograms>();
+
+			std::lock_guard<std::mutex> lock(threadsMutex);
+			threads.push_back(histograms);
+		}
+
+		return *histograms;
+	}
+
+public:
+	static bool isCompiledIn()
+	{
+#ifdef DAYW_PROFILE
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+	static void setEnabled(bool isEnabled) { enabled = isEnabled; }
+
+	static void record(ProfilePhase phase, unsigned long long nanoseconds)
+	{
+		getThreadHistograms().phases[phase].record(nanoseconds);
+	}
+
+	static void reset()
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+
+		for (auto& thread : threads)
+			for (LatencyHistogram& histogram : thread->phases)
+				histogram.reset();
+	}
+
+	static const char* getPhaseName(int phase)
+	{
+		static const char* names[] = { "tick", "nextState plant eating", "nextState predator", "nextState plant", "nextState food",
+			"act idle", "act searching eat", "act eating", "act runaway", "act waiting pair", "act searching pair", "act reproducing", "act died",
+			"target search", "movement", "births", "handleAllDied", "makeActiveAllBorn", "render", "handleConsole" };
+
+		return phase >= 0 && phase < PHASE_COUNT ? names[phase] : "?";
+	}
+
+	// Coarse traces keep to once-per-tick and per-frame phases; per-entity phases need fine detail
+	static bool isTraced(ProfilePhase phase)
+	{
+		if (!Tracer::isEnabled())
+			return false;
+
+		return Tracer::getDetail() == Tracer::FINE || phase == PHASE_TICK || phase == PHASE_HANDLE_ALL_DIED
+			|| phase == PHASE_MAKE_ACTIVE_ALL_BORN || phase == PHASE_RENDER || phase == PHASE_HANDLE_CONSOLE;
+	}
+
+	// One line per phase that was hit, merged across threads; calls per tick are relative to the tick phase
+	static void report(std::vector<std::string>& lines)
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+
+		std::vector<std::vector<unsigned long long>> buckets(PHASE_COUNT, std::vector<unsigned long long>(LatencyHistogram::BUCKET_COUNT));
+		std::vector<unsigned long long> counts(PHASE_COUNT);
+		std::vector<unsigned long long> maxima(PHASE_COUNT);
+
+		for (auto& thread : threads)
+			for (int phase = 0; phase < PHASE_COUNT; phase++)
+				thread->phases[phase].addTo(buckets[phase], counts[phase], maxima[phase]);
+
+		char line[160];
+		std::snprintf(line, sizeof(line), "%-24s %10s %10s %10s %10s %10s", "phase", "calls", "calls/tick", "p50 us", "p99 us", "max us");
+		lines.push_back(line);
+
+		double ticks = (double)counts[PHASE_TICK];
+
+		for (int phase = 0; phase < PHASE_COUNT; phase++)
+		{
+			if (!counts[phase])
+				continue;
+
+			std::snprintf(line, sizeof(line), "%-24s %10llu %10.2f %10.2f %10.2f %10.2f", getPhaseName(phase), counts[phase],
+				ticks > 0 ? counts[phase] / ticks : 0.0,
+				LatencyHistogram::percentileOf(buckets[phase], counts[phase], maxima[phase], 0.5) / 1000,
+				LatencyHistogram::percentileOf(buckets[phase], counts[phase], maxima[phase], 0.99) / 1000,
+				maxima[phase] / 1000.0);
+
+			lines.push_back(line);
+		}
+	}
+
+	// Per-tick figures plus one line per tag for the calling thread; tags are exclusive of nested scopes,
+	// and the live columns are process-wide bytes still held by blocks each tag allocated
+	static void reportAllocations(const AllocationTickStats& ticks, std::vector<std::string>& lines)
+	{
+		char line[160];
+
+		std::snprintf(line, sizeof(line), "allocations/tick mean %.1f max %llu last %llu, bytes/tick mean %.0f, peak live bytes %lld, zero-allocation ticks %lld of %lld",
+			ticks.ticks ? (double)ticks.allocations / ticks.ticks : 0.0, ticks.maxAllocations, ticks.lastAllocations,
+			ticks.ticks ? (double)ticks.bytes / ticks.ticks : 0.0, ticks.maxPeakLiveBytes, ticks.zeroAllocationTicks, ticks.ticks);
+		lines.push_back(line);
+
+		std::snprintf(line, sizeof(line), "%-24s %12s %12s %14s %14s %14s", "tag", "allocations", "allocs/tick", "bytes", "live", "peak live");
+		lines.push_back(line);
+
+		for (int tag = 0; tag <= PHASE_COUNT; tag++)
+		{
+			AllocationCounts counts = AllocationTracker::getTagCounts(tag);
+
+			if (!counts.allocations)
+				continue;
+
+			std::snprintf(line, sizeof(line), "%-24s %12llu %12.2f %14llu %14lld %14lld", tag == AllocationTracker::UNTAGGED ? "untagged" : getPhaseName(tag - 1),
+				counts.allocations, ticks.ticks ? (double)counts.allocations / ticks.ticks : 0.0, counts.bytes,
+				AllocationTracker::getTagLiveBytes(tag), AllocationTracker::getTagPeakLiveBytes(tag));
+			lines.push_back(line);
+		}
+	}
+
+	static void report(std::ostream& out)
+	{
+		std::vector<std::string> lines;
+		report(lines);
+
+		for (std::string& line : lines)
+			out << line << "\n";
+	}
+};
+
+class ProfileScope
+{
+	ProfilePhase phase;
+	bool isRecording;
+	std::chrono::steady_clock::time_point start;
+	long long traceStart;
+	int previousTag;
+
+public:
+	ProfileScope(ProfilePhase phase) : phase(phase), isRecording(Profiler::isEnabled()),
+		traceStart(Profiler::isTraced(phase) ? Tracer::getTime() : -1), previousTag(AllocationTracker::UNTAGGED)
+	{
+#ifdef DAYW_TRACK_ALLOCATIONS
+		previousTag = AllocationTracker::setTag(phase + 1);
+#endif
+
+		if (isRecording)
+			start = std::chrono::steady_clock::now();
+	}
+
+	~ProfileScope()
+	{
+		if (isRecording)
+			Profiler::record(phase, (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+		if (traceStart >= 0)
+			Tracer::span(Profiler::getPhaseName(phase), traceStart, Tracer::getTime() - traceStart);
+
+#ifdef DAYW_TRACK_ALLOCATIONS
+		AllocationTracker::setTag(previousTag);
+#endif
+	}
+};
+
+std::atomic<bool> Profiler::enabled(false);
+std::mutex Profiler::threadsMutex;
+std::vector<std::shared_ptr<Profiler::ThreadHistograms>> Profiler::threads;
@@ -0,0 +1,73 @@
+#pragma once
+#include <algorithm>
+#include "Position.h"
+
+struct Region
+{
+	int left;
+	int bottom;
+	int right;
+	int top;
+
+	bool isCircle;
+	int centerX;
+	int centerY;
+	int radius;
+
+	Region() : left(1), bottom(1), right(0), top(0), isCircle(false), centerX(0), centerY(0), radius(0) {}
+
+	static Region rectangle(int x1, int y1, int x2, int y2)
+	{
+		Region region;
+		region.left = std::min(x1, x2);
+		region.right = std::max(x1, x2);
+		region.bottom = std::min(y1, y2);
+		region.top = std::max(y1, y2);
+
+		return region;
+	}
+
+	static Region circle(int x, int y, int radius)
+	{
+		Region region = rectangle(x - radius, y - radius, x + radius, y + radius);
+		region.isCircle = true;
+		region.centerX = x;
+		region.centerY = y;
+		region.radius = radius;
+
+		return region;
+	}
+
+	// Clips the bounding box to a height x width map with 1-based positions
+	void clip(int height, int width)
+	{
+		left = std::max(left, 1);
+		bottom = std::max(bottom, 1);
+		right = std::min(right, width);
+		top = std::min(top, height);
+	}
+
+	bool isEmpty() const
+	{
+		return left > right || bottom > top;
+	}
+
+	bool contains(int x, int y) const
+	{
+		if (x < left || x > right || y < bottom || y > top)
+			return false;
+
+		if (!isCircle)
+			return true;
+
+		long long dx = x - centerX;
+		long long dy = y - centerY;
+
+		return dx * dx + dy * dy <= (long long)radius * radius;
+	}
+
+	bool contains(Position pos) const
+	{
+		return contains(pos.getX(), pos.getY());
+	}
+};
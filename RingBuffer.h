@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+template<typename T>
+class RingBuffer
+{
+	std::vector<T> items;
+	size_t mask;
+
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+
+public:
+	RingBuffer(size_t capacity) : head(0), tail(0)
+	{
+		size_t size = 2;
+
+		while (size < capacity)
+			size <<= 1;
+
+		items = std::vector<T>(size);
+		mask = size - 1;
+	}
+
+	bool push(const T& item)
+	{
+		size_t currentTail = tail.load(std::memory_order_relaxed);
+
+		if (currentTail - head.load(std::memory_order_acquire) > mask)
+			return false;
+
+		items[currentTail & mask] = item;
+		tail.store(currentTail + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		size_t currentHead = head.load(std::memory_order_relaxed);
+
+		if (currentHead == tail.load(std::memory_order_acquire))
+			return false;
+
+		item = items[currentHead & mask];
+		head.store(currentHead + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	size_t size()
+	{
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	bool empty() { return size() == 0; }
+
+	size_t capacity() { return mask + 1; }
+};
@@ -0,0 +1,363 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <ostream>
+#include <memory>
+#include <functional>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "Benchmark.h"
+#include "Profiler.h"
+
+struct ScalingResult
+{
+	int size;
+	double density;
+	PopulationMix mix;
+	int threads;
+
+	long long ticks;
+	double meanEntities;
+	double ticksPerSecond;
+	double entityUpdatesPerSecond;
+
+	double p50Microseconds;
+	double p99Microseconds;
+	double maxMicroseconds;
+
+	// High-water mark of the whole process when this configuration finished, not of this configuration alone
+	long long processPeakRssKilobytes;
+};
+
+struct ScalingFit
+{
+	double density;
+	PopulationMix mix;
+	int threads;
+
+	// Exponent k of seconds per tick ~ entities^k, fitted by least squares over the map sizes
+	double exponent;
+	bool hasBaseline;
+	double baselineExponent;
+	bool isRegressed;
+};
+
+// Runs seeded end-to-end simulations over (map size, density, mix, threads) and fits how tick time grows with population
+class ScalingHarness
+{
+	static constexpr double MIN_FIT_ENTITIES = 4;
+
+	std::vector<int> sizes;
+	std::vector<double> densities;
+	std::vector<PopulationMix> mixes;
+	std::vector<int> threadCounts;
+	unsigned long long seed;
+	long long warmupTicks;
+	long long minTicks;
+	double configurationSeconds;
+	double tolerance;
+
+	std::vector<ScalingResult> results;
+	std::vector<ScalingFit> fits;
+
+	struct WorldRun
+	{
+		long long ticks;
+		double entityTicks;
+		double seconds;
+		LatencyHistogram latency;
+	};
+
+	// The tick itself is single-threaded, so extra threads run identical worlds side by side
+	void runWorld(int size, double density, const PopulationMix& mix, unsigned long long worldSeed, WorldRun& run)
+	{
+		std::unique_ptr<Model> model = Benchmark::createWorld(size, density, worldSeed, mix);
+		View view(model.get());
+		Controller controller(model.get(), &view);
+
+		for (long long i = 0; i < warmupTicks; i++)
+			controller.nextStateOfModel();
+
+		run.ticks = 0;
+		run.entityTicks = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		double elapsed = 0;
+
+		while (run.ticks < minTicks || elapsed < configurationSeconds)
+		{
+			if (model->getEntities().empty())
+				break;
+
+			run.entityTicks += (double)model->getEntities().size();
+
+			auto begin = std::chrono::steady_clock::now();
+			controller.nextStateOfModel();
+			auto end = std::chrono::steady_clock::now();
+
+			run.latency.record((unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+			run.ticks++;
+
+			elapsed = std::chrono::duration<double>(end - start).count();
+		}
+
+		run.seconds = elapsed;
+	}
+
+	static std::string keyOf(double density, const PopulationMix& mix, int threads)
+	{
+		std::ostringstream key;
+		key << density << " " << mix.toString() << " " << threads;
+
+		return key.str();
+	}
+
+	void fit()
+	{
+		fits.clear();
+
+		for (double density : densities)
+			for (const PopulationMix& mix : mixes)
+				for (int threads : threadCounts)
+				{
+					double n = 0, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+
+					for (const ScalingResult& result : results)
+					{
+						if (result.density != density || result.mix.toString() != mix.toString() || result.threads != threads)
+							continue;
+
+						// Worlds that died out measure empty ticks, not scaling
+						if (result.meanEntities < MIN_FIT_ENTITIES || result.ticksPerSecond <= 0)
+							continue;
+
+						double x = std::log(result.meanEntities);
+						double y = std::log(threads / result.ticksPerSecond);
+
+						n++;
+						sumX += x;
+						sumY += y;
+						sumXX += x * x;
+						sumXY += x * y;
+					}
+
+					double denominator = n * sumXX - sumX * sumX;
+
+					if (n < 2 || std::fabs(denominator) < 1e-12)
+						continue;
+
+					ScalingFit scalingFit;
+					scalingFit.density = density;
+					scalingFit.mix = mix;
+					scalingFit.threads = threads;
+					scalingFit.exponent = (n * sumXY - sumX * sumY) / denominator;
+					scalingFit.hasBaseline = false;
+					scalingFit.baselineExponent = 0;
+					scalingFit.isRegressed = false;
+
+					fits.push_back(scalingFit);
+				}
+	}
+
+public:
+	ScalingHarness(unsigned long long seed) : sizes({ 12, 16, 20, 24 }), densities({ 0.1 }), mixes(1), threadCounts({ 1 }), seed(seed),
+		warmupTicks(2), minTicks(3), configurationSeconds(1), tolerance(0.15) {}
+
+	void setSizes(std::vector<int> newSizes) { sizes = newSizes; }
+	void setDensities(std::vector<double> newDensities) { densities = newDensities; }
+	void setMixes(std::vector<PopulationMix> newMixes) { mixes = newMixes; }
+	void setThreadCounts(std::vector<int> newThreadCounts) { threadCounts = newThreadCounts; }
+	void setConfigurationSeconds(double seconds) { configurationSeconds = seconds; }
+	void setTolerance(double newTolerance) { tolerance = newTolerance; }
+
+	const std::vector<ScalingResult>& getResults() { return results; }
+	const std::vector<ScalingFit>& getFits() { return fits; }
+
+	// Process-wide and never falls, so a small configuration run after a large one reports the large one's peak
+	static long long getProcessPeakRssKilobytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return (long long)(counters.PeakWorkingSetSize / 1024);
+
+		return 0;
+#else
+		struct rusage usage;
+
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			return usage.ru_maxrss;
+
+		return 0;
+#endif
+	}
+
+	void run(std::function<void(const ScalingResult&)> progress = nullptr)
+	{
+		results.clear();
+
+		for (double density : densities)
+			for (const PopulationMix& mix : mixes)
+				for (int threads : threadCounts)
+					for (int size : sizes)
+					{
+						std::vector<WorldRun> runs(std::max(1, threads));
+						std::vector<std::thread> workers;
+
+						for (int i = 0; i < (int)runs.size(); i++)
+							workers.push_back(std::thread(&ScalingHarness::runWorld, this, size, density, std::cref(mix), seed, std::ref(runs[i])));
+
+						for (std::thread& worker : workers)
+							worker.join();
+
+						ScalingResult result;
+						result.size = size;
+						result.density = density;
+						result.mix = mix;
+						result.threads = (int)runs.size();
+						result.ticks = 0;
+						result.ticksPerSecond = 0;
+						result.entityUpdatesPerSecond = 0;
+
+						double entityTicks = 0;
+						std::vector<unsigned long long> buckets(LatencyHistogram::BUCKET_COUNT);
+						unsigned long long count = 0;
+						unsigned long long max = 0;
+
+						for (WorldRun& run : runs)
+						{
+							result.ticks += run.ticks;
+							if (run.seconds > 0)
+							{
+								result.ticksPerSecond += run.ticks / run.seconds;
+								result.entityUpdatesPerSecond += run.entityTicks / run.seconds;
+							}
+							entityTicks += run.entityTicks;
+
+							run.latency.addTo(buckets, count, max);
+						}
+
+						result.meanEntities = result.ticks ? entityTicks / result.ticks : 0;
+						result.p50Microseconds = LatencyHistogram::percentileOf(buckets, count, max, 0.5) / 1000;
+						result.p99Microseconds = LatencyHistogram::percentileOf(buckets, count, max, 0.99) / 1000;
+						result.maxMicroseconds = max / 1000.0;
+						result.processPeakRssKilobytes = getProcessPeakRssKilobytes();
+
+						results.push_back(result);
+
+						if (progress)
+							progress(result);
+					}
+
+		fit();
+	}
+
+	// Baseline lines are "density mix threads exponent"; '#' starts a comment
+	bool compareWithBaseline(const std::string& path)
+	{
+		std::ifstream in(path);
+
+		if (!in)
+			return false;
+
+		std::string line;
+
+		while (std::getline(in, line))
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+
+			std::istringstream fields(line);
+			double density;
+			std::string mixText;
+			int threads;
+			double exponent;
+
+			if (!(fields >> density >> mixText >> threads >> exponent))
+				continue;
+
+			PopulationMix mix;
+
+			if (!mix.parse(mixText))
+				continue;
+
+			for (ScalingFit& scalingFit : fits)
+				if (keyOf(scalingFit.density, scalingFit.mix, scalingFit.threads) == keyOf(density, mix, threads))
+				{
+					scalingFit.hasBaseline = true;
+					scalingFit.baselineExponent = exponent;
+					scalingFit.isRegressed = scalingFit.exponent > exponent + tolerance;
+				}
+		}
+
+		return true;
+	}
+
+	bool saveBaseline(const std::string& path)
+	{
+		std::ofstream out(path);
+
+		out << "# density mix threads exponent\n";
+
+		for (const ScalingFit& scalingFit : fits)
+			out << scalingFit.density << " " << scalingFit.mix.toString() << " " << scalingFit.threads << " " << scalingFit.exponent << "\n";
+
+		return (bool)out;
+	}
+
+	bool hasRegression()
+	{
+		for (const ScalingFit& scalingFit : fits)
+			if (scalingFit.isRegressed)
+				return true;
+
+		return false;
+	}
+
+	void writeJson(std::ostream& out)
+	{
+		out << "{\n  \"seed\": " << seed << ",\n  \"configuration_seconds\": " << configurationSeconds << ",\n  \"tolerance\": " << tolerance << ",\n  \"results\": [";
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const ScalingResult& result = results[i];
+
+			out << (i ? ",\n" : "\n") << "    { \"size\": " << result.size << ", \"density\": " << result.density
+				<< ", \"mix\": \"" << result.mix.toString() << "\", \"threads\": " << result.threads
+				<< ", \"ticks\": " << result.ticks << ", \"mean_entities\": " << result.meanEntities
+				<< ", \"ticks_per_sec\": " << result.ticksPerSecond << ", \"entity_updates_per_sec\": " << result.entityUpdatesPerSecond
+				<< ", \"p50_us\": " << result.p50Microseconds << ", \"p99_us\": " << result.p99Microseconds << ", \"max_us\": " << result.maxMicroseconds
+				<< ", \"process_peak_rss_kb\": " << result.processPeakRssKilobytes << " }";
+		}
+
+		out << "\n  ],\n  \"fits\": [";
+
+		for (size_t i = 0; i < fits.size(); i++)
+		{
+			const ScalingFit& scalingFit = fits[i];
+
+			out << (i ? ",\n" : "\n") << "    { \"density\": " << scalingFit.density << ", \"mix\": \"" << scalingFit.mix.toString()
+				<< "\", \"threads\": " << scalingFit.threads << ", \"exponent\": " << scalingFit.exponent;
+
+			if (scalingFit.hasBaseline)
+				out << ", \"baseline_exponent\": " << scalingFit.baselineExponent << ", \"regressed\": " << (scalingFit.isRegressed ? "true" : "false");
+
+			out << " }";
+		}
+
+		out << "\n  ]\n}\n";
+	}
+};
@@ -113,4 +113,36 @@ public:
 			counter++;
 		}
 	}
+
+	static Entity* randomFrom(std::set<Entity*> from, RandomEngine& engine)
+	{
+		int index = MathUtility::randomInt(engine, 0, from.size() - 1);
+
+		int counter = 0;
+		for (Entity* item : from)
+		{
+			if (counter == index)
+				return item;
+
+			counter++;
+		}
+
+		return nullptr;
+	}
+
+	static Position randomFrom(std::set<Position> from, RandomEngine& engine)
+	{
+		int index = MathUtility::randomInt(engine, 0, from.size() - 1);
+
+		int counter = 0;
+		for (Position item : from)
+		{
+			if (counter == index)
+				return item;
+
+			counter++;
+		}
+
+		return Position(-1, -1);
+	}
 };
\ No newline at end of file
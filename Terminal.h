@@ -0,0 +1,220 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/ioctl.h>
+#endif
+
+class Terminal
+{
+	static const int SHORT_GAP = 6;
+
+	int width;
+	int height;
+
+	std::vector<char> front;
+	std::vector<char> back;
+	std::vector<char> output;
+
+	bool invalidated;
+
+	int cursorRow;
+	int cursorColumn;
+
+	void append(const char* text, size_t length)
+	{
+		output.insert(output.end(), text, text + length);
+	}
+
+	void appendNumber(int value)
+	{
+		char digits[12];
+		int count = 0;
+
+		do
+		{
+			digits[count++] = (char)('0' + value % 10);
+			value /= 10;
+		} while (value > 0);
+
+		while (count > 0)
+			output.push_back(digits[--count]);
+	}
+
+	void appendMove(int row, int column)
+	{
+		output.push_back('\x1b');
+		output.push_back('[');
+		appendNumber(row + 1);
+		output.push_back(';');
+		appendNumber(column + 1);
+		output.push_back('H');
+	}
+
+	void flush()
+	{
+		if (output.empty())
+			return;
+
+#ifdef _WIN32
+		DWORD written = 0;
+		WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), output.data(), (DWORD)output.size(), &written, nullptr);
+#else
+		size_t offset = 0;
+
+		while (offset < output.size())
+		{
+			ssize_t written = ::write(STDOUT_FILENO, output.data() + offset, output.size() - offset);
+
+			if (written <= 0)
+				break;
+
+			offset += (size_t)written;
+		}
+#endif
+
+		output.clear();
+	}
+
+public:
+	Terminal() : width(0), height(0), invalidated(true), cursorRow(0), cursorColumn(0)
+	{
+#ifdef _WIN32
+		HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
+		DWORD mode = 0;
+
+		if (GetConsoleMode(handle, &mode))
+			SetConsoleMode(handle, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#endif
+	}
+
+	static bool querySize(int& rows, int& columns)
+	{
+#ifdef _WIN32
+		CONSOLE_SCREEN_BUFFER_INFO info;
+
+		if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info))
+			return false;
+
+		rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+		columns = info.srWindow.Right - info.srWindow.Left + 1;
+#else
+		struct winsize size;
+
+		if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_row == 0 || size.ws_col == 0)
+			return false;
+
+		rows = size.ws_row;
+		columns = size.ws_col;
+#endif
+
+		return true;
+	}
+
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+
+	void resize(int newWidth, int newHeight)
+	{
+		if (newWidth == width && newHeight == height)
+			return;
+
+		width = newWidth;
+		height = newHeight;
+
+		front.assign((size_t)width * height, ' ');
+		back.assign((size_t)width * height, ' ');
+		output.reserve((size_t)width * height * 4 + 64);
+
+		invalidated = true;
+	}
+
+	void invalidate() { invalidated = true; }
+
+	void clear()
+	{
+		std::memset(back.data(), ' ', back.size());
+	}
+
+	void put(int row, int column, char symbol)
+	{
+		if (row >= 0 && row < height && column >= 0 && column < width)
+			back[(size_t)row * width + column] = symbol;
+	}
+
+	void write(int row, int column, const char* text, size_t length)
+	{
+		if (row < 0 || row >= height || column >= width)
+			return;
+
+		for (size_t i = 0; i < length && column + (int)i < width; i++)
+			if (column + (int)i >= 0)
+				back[(size_t)row * width + column + i] = text[i];
+	}
+
+	void write(int row, int column, const char* text)
+	{
+		write(row, column, text, std::strlen(text));
+	}
+
+	void write(int row, int column, const std::string& text)
+	{
+		write(row, column, text.data(), text.size());
+	}
+
+	void setCursor(int row, int column)
+	{
+		cursorRow = row;
+		cursorColumn = column;
+	}
+
+	void present()
+	{
+		output.clear();
+
+		if (invalidated)
+		{
+			append("\x1b[0m\x1b[2J", 8);
+			std::memset(front.data(), ' ', front.size());
+			invalidated = false;
+		}
+
+		int printedRow = -1;
+		int printedColumn = -1;
+
+		for (int row = 0; row < height; row++)
+		{
+			const char* next = back.data() + (size_t)row * width;
+			char* current = front.data() + (size_t)row * width;
+
+			for (int column = 0; column < width; column++)
+			{
+				if (next[column] == current[column])
+					continue;
+
+				if (printedRow == row && column > printedColumn && column - printedColumn <= SHORT_GAP)
+					append(next + printedColumn, column - printedColumn);
+
+				else if (printedRow != row || printedColumn != column)
+					appendMove(row, column);
+
+				output.push_back(next[column]);
+				current[column] = next[column];
+
+				printedRow = row;
+				printedColumn = column + 1;
+			}
+		}
+
+		appendMove(cursorRow, cursorColumn);
+		flush();
+	}
+};
@@ -0,0 +1,315 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <ostream>
+#include <fstream>
+#include <algorithm>
+
+// Spans and counters compile in only when DAYW_TRACE is defined; events record only while enabled
+#ifdef DAYW_TRACE
+#define TRACE_SCOPE(name) TraceScope traceScope(name)
+#define TRACE_COUNTER(name, value) Tracer::counter(name, (long long)(value))
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_COUNTER(name, value)
+#endif
+
+// Names must outlive the tracer, so they are string literals
+struct TraceEvent
+{
+	const char* name;
+	char type;
+	long long start;
+	long long value;
+};
+
+// Writes Chrome trace-event JSON, which chrome://tracing and Perfetto both open
+class Tracer
+{
+public:
+	enum Detail
+	{
+		COARSE,
+		FINE
+	};
+
+	static const int CHUNK_EVENTS = 4096;
+	static const int MAX_CHUNKS = 4096;
+
+private:
+	// Only the owning thread appends; chunks and the count are published with release so a merge reads whole events
+	struct ThreadBuffer
+	{
+		int id;
+		std::atomic<const char*> name;
+		std::atomic<TraceEvent*> chunks[MAX_CHUNKS];
+		std::atomic<long long> count;
+		std::atomic<long long> dropped;
+
+		ThreadBuffer(int id) : id(id), name(nullptr), count(0), dropped(0)
+		{
+			for (auto& chunk : chunks)
+				chunk.store(nullptr, std::memory_order_relaxed);
+		}
+
+		~ThreadBuffer()
+		{
+			for (auto& chunk : chunks)
+				delete[] chunk.load(std::memory_order_relaxed);
+		}
+	};
+
+	struct MergedEvent
+	{
+		TraceEvent event;
+		int thread;
+	};
+
+	static std::atomic<bool> enabled;
+	static std::atomic<int> detail;
+	static std::atomic<long long> maxEventsPerThread;
+	static std::mutex threadsMutex;
+	static std::vector<std::shared_ptr<ThreadBuffer>> threads;
+
+	static ThreadBuffer& getThreadBuffer()
+	{
+		thread_local std::shared_ptr<ThreadBuffer> buffer;
+
+		if (!buffer)
+		{
+			std::lock_guard<std::mutex> lock(threadsMutex);
+
+			buffer = std::make_shared<ThreadBuffer>((int)threads.size() + 1);
+			threads.push_back(buffer);
+		}
+
+		return *buffer;
+	}
+
+	static std::chrono::steady_clock::time_point getOrigin()
+	{
+		static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+		return origin;
+	}
+
+	static void append(const char* name, char type, long long start, long long value)
+	{
+		ThreadBuffer& buffer = getThreadBuffer();
+		long long index = buffer.count.load(std::memory_order_relaxed);
+
+		if (index >= maxEventsPerThread.load(std::memory_order_relaxed))
+		{
+			buffer.dropped.store(buffer.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return;
+		}
+
+		std::atomic<TraceEvent*>& chunk = buffer.chunks[index / CHUNK_EVENTS];
+		TraceEvent* events = chunk.load(std::memory_order_relaxed);
+
+		if (!events)
+		{
+			events = new TraceEvent[CHUNK_EVENTS];
+			chunk.store(events, std::memory_order_release);
+		}
+
+		TraceEvent& event = events[index % CHUNK_EVENTS];
+		event.name = name;
+		event.type = type;
+		event.start = start;
+		event.value = value;
+
+		buffer.count.store(index + 1, std::memory_order_release);
+	}
+
+	static void writeString(std::ostream& out, const char* text)
+	{
+		out << '"';
+
+		for (; *text; text++)
+		{
+			if (*text == '"' || *text == '\\')
+				out << '\\';
+
+			out << *text;
+		}
+
+		out << '"';
+	}
+
+	static void writeMicroseconds(std::ostream& out, long long nanoseconds)
+	{
+		char number[32];
+		std::snprintf(number, sizeof(number), "%lld.%03lld", nanoseconds / 1000, nanoseconds % 1000);
+
+		out << number;
+	}
+
+public:
+	static bool isCompiledIn()
+	{
+#ifdef DAYW_TRACE
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	static void setEnabled(bool isEnabled)
+	{
+		getOrigin();
+		enabled = isEnabled;
+	}
+
+	static Detail getDetail() { return (Detail)detail.load(std::memory_order_relaxed); }
+	static void setDetail(Detail newDetail) { detail = newDetail; }
+
+	// Bounds memory on long runs; events past the limit are counted as dropped
+	static void setMaxEventsPerThread(long long maxEvents)
+	{
+		maxEventsPerThread = std::max(0LL, std::min(maxEvents, (long long)CHUNK_EVENTS * MAX_CHUNKS));
+	}
+
+	static void setThreadName(const char* name)
+	{
+		getThreadBuffer().name.store(name, std::memory_order_release);
+	}
+
+	// Nanoseconds since the tracer was first used
+	static long long getTime()
+	{
+		return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - getOrigin()).count();
+	}
+
+	static void span(const char* name, long long start, long long duration)
+	{
+		append(name, 'X', start, duration);
+	}
+
+	static void counter(const char* name, long long value)
+	{
+		if (isEnabled())
+			append(name, 'C', getTime(), value);
+	}
+
+	static long long getEventCount()
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		long long total = 0;
+
+		for (auto& thread : threads)
+			total += std::min(thread->count.load(std::memory_order_acquire), maxEventsPerThread.load(std::memory_order_relaxed));
+
+		return total;
+	}
+
+	static long long getDroppedCount()
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		long long total = 0;
+
+		for (auto& thread : threads)
+			total += thread->dropped.load(std::memory_order_relaxed);
+
+		return total;
+	}
+
+	// Merges every thread's buffer by time; meant for shutdown, but safe while threads still append
+	static void write(std::ostream& out)
+	{
+		std::vector<MergedEvent> merged;
+		std::vector<std::pair<int, const char*>> names;
+
+		{
+			std::lock_guard<std::mutex> lock(threadsMutex);
+
+			for (auto& thread : threads)
+			{
+				long long count = thread->count.load(std::memory_order_acquire);
+
+				for (long long i = 0; i < count; i++)
+				{
+					MergedEvent event;
+					event.event = thread->chunks[i / CHUNK_EVENTS].load(std::memory_order_acquire)[i % CHUNK_EVENTS];
+					event.thread = thread->id;
+
+					merged.push_back(event);
+				}
+
+				const char* name = thread->name.load(std::memory_order_acquire);
+
+				if (name)
+					names.push_back(std::make_pair(thread->id, name));
+			}
+		}
+
+		std::stable_sort(merged.begin(), merged.end(), [](const MergedEvent& a, const MergedEvent& b) { return a.event.start < b.event.start; });
+
+		out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+		out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"DAYW\"}}";
+
+		for (auto& name : names)
+		{
+			out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << name.first << ",\"args\":{\"name\":";
+			writeString(out, name.second);
+			out << "}}";
+		}
+
+		for (MergedEvent& item : merged)
+		{
+			out << ",\n{\"name\":";
+			writeString(out, item.event.name);
+			out << ",\"ph\":\"" << item.event.type << "\",\"ts\":";
+			writeMicroseconds(out, item.event.start);
+			out << ",\"pid\":1,\"tid\":" << item.thread;
+
+			if (item.event.type == 'X')
+			{
+				out << ",\"dur\":";
+				writeMicroseconds(out, item.event.value);
+				out << "}";
+			}
+
+			else
+				out << ",\"args\":{\"value\":" << item.event.value << "}}";
+		}
+
+		out << "\n]}\n";
+	}
+
+	static bool write(const std::string& path)
+	{
+		std::ofstream out(path, std::ios::trunc);
+		write(out);
+
+		return (bool)out;
+	}
+};
+
+class TraceScope
+{
+	const char* name;
+	long long start;
+
+public:
+	TraceScope(const char* name) : name(name), start(Tracer::isEnabled() ? Tracer::getTime() : -1) {}
+
+	~TraceScope()
+	{
+		if (start >= 0)
+			Tracer::span(name, start, Tracer::getTime() - start);
+	}
+};
+
+std::atomic<bool> Tracer::enabled(false);
+std::atomic<int> Tracer::detail(Tracer::COARSE);
+std::atomic<long long> Tracer::maxEventsPerThread(1LL << 22);
+std::mutex Tracer::threadsMutex;
+std::vector<std::shared_ptr<Tracer::ThreadBuffer>> Tracer::threads;
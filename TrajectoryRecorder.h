@@ -0,0 +1,550 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include "BinaryUtility.h"
+#include "RingBuffer.h"
+#include "Model.h"
+#include "Tracer.h"
+
+struct TrajectorySample
+{
+	long long tick;
+	int id;
+	unsigned short xPos;
+	unsigned short yPos;
+	unsigned short health;
+	unsigned short hunger;
+	unsigned char state;
+};
+
+class TrajectoryFormat
+{
+public:
+	static const unsigned int MAGIC = 0x54594144;
+	static const unsigned int INDEX_MAGIC = 0x49594144;
+	static const unsigned int VERSION = 1;
+
+	static const int HEADER_SIZE = 8;
+	static const int INDEX_ENTRY_SIZE = 48;
+	static const int TRAILER_SIZE = 12;
+
+	struct Chunk
+	{
+		unsigned long long offset;
+		unsigned long long size;
+		long long firstTick;
+		long long lastTick;
+		int minId;
+		int maxId;
+		unsigned int entityCount;
+		unsigned int sampleCount;
+	};
+};
+
+class TrajectoryRecorder
+{
+	RingBuffer<TrajectorySample> queue;
+	std::thread writer;
+	std::atomic<bool> stopping;
+	std::atomic<long long> stallCount;
+
+	// The ring itself is lock-free; these only park the writer on an empty ring and the producer on a full one
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::condition_variable idle;
+
+	std::ofstream file;
+	long long chunkTicks;
+	unsigned long long written;
+
+	std::vector<TrajectorySample> pending;
+	std::vector<TrajectoryFormat::Chunk> chunks;
+	std::vector<unsigned char> column;
+	std::vector<unsigned char> payload;
+
+	void beginColumn()
+	{
+		column.clear();
+	}
+
+	void endColumn()
+	{
+		BinaryUtility::writeVarint(payload, column.size());
+		payload.insert(payload.end(), column.begin(), column.end());
+	}
+
+	static bool byIdAndTick(const TrajectorySample& one, const TrajectorySample& another)
+	{
+		return one.id < another.id || (one.id == another.id && one.tick < another.tick);
+	}
+
+	void writeChunk()
+	{
+		if (pending.empty())
+			return;
+
+		TRACE_SCOPE("trajectory chunk write");
+
+		std::sort(pending.begin(), pending.end(), byIdAndTick);
+
+		TrajectoryFormat::Chunk chunk;
+
+		chunk.offset = written;
+		chunk.firstTick = pending.front().tick;
+		chunk.lastTick = pending.front().tick;
+		chunk.minId = pending.front().id;
+		chunk.maxId = pending.back().id;
+		chunk.entityCount = 0;
+		chunk.sampleCount = (unsigned int)pending.size();
+
+		std::vector<std::pair<size_t, size_t>> runs;
+
+		for (size_t i = 0; i < pending.size();)
+		{
+			size_t j = i;
+
+			while (j < pending.size() && pending[j].id == pending[i].id)
+			{
+				chunk.firstTick = std::min(chunk.firstTick, pending[j].tick);
+				chunk.lastTick = std::max(chunk.lastTick, pending[j].tick);
+				j++;
+			}
+
+			runs.push_back(std::make_pair(i, j));
+			i = j;
+		}
+
+		chunk.entityCount = (unsigned int)runs.size();
+
+		payload.clear();
+		BinaryUtility::writeVarint(payload, runs.size());
+
+		beginColumn();
+		int previousId = 0;
+		for (auto& run : runs)
+		{
+			BinaryUtility::writeVarint(column, (unsigned int)(pending[run.first].id - previousId));
+			previousId = pending[run.first].id;
+		}
+		endColumn();
+
+		beginColumn();
+		for (auto& run : runs)
+			BinaryUtility::writeVarint(column, run.second - run.first);
+		endColumn();
+
+		beginColumn();
+		for (auto& run : runs)
+		{
+			long long previousTick = chunk.firstTick;
+
+			for (size_t i = run.first; i < run.second; i++)
+			{
+				BinaryUtility::writeVarint(column, (unsigned long long)(pending[i].tick - previousTick));
+				previousTick = pending[i].tick;
+			}
+		}
+		endColumn();
+
+		writeDeltaColumn(runs, &TrajectorySample::xPos);
+		writeDeltaColumn(runs, &TrajectorySample::yPos);
+		writeDeltaColumn(runs, &TrajectorySample::health);
+		writeDeltaColumn(runs, &TrajectorySample::hunger);
+
+		beginColumn();
+		for (size_t i = 0; i < pending.size(); i += 2)
+		{
+			unsigned char packed = pending[i].state & 0x0F;
+
+			if (i + 1 < pending.size())
+				packed |= (pending[i + 1].state & 0x0F) << 4;
+
+			column.push_back(packed);
+		}
+		endColumn();
+
+		file.write((const char*)payload.data(), payload.size());
+
+		chunk.size = payload.size();
+		written += payload.size();
+
+		chunks.push_back(chunk);
+		pending.clear();
+	}
+
+	void writeDeltaColumn(std::vector<std::pair<size_t, size_t>>& runs, unsigned short TrajectorySample::* field)
+	{
+		beginColumn();
+
+		for (auto& run : runs)
+		{
+			long long previous = 0;
+
+			for (size_t i = run.first; i < run.second; i++)
+			{
+				BinaryUtility::writeVarint(column, BinaryUtility::zigzag((long long)(pending[i].*field) - previous));
+				previous = pending[i].*field;
+			}
+		}
+
+		endColumn();
+	}
+
+	void writeIndex()
+	{
+		std::vector<unsigned char> index(chunks.size() * TrajectoryFormat::INDEX_ENTRY_SIZE + TrajectoryFormat::TRAILER_SIZE);
+		unsigned char* out = index.data();
+
+		for (TrajectoryFormat::Chunk& chunk : chunks)
+		{
+			BinaryUtility::writeU64(out, chunk.offset);
+			BinaryUtility::writeU64(out + 8, chunk.size);
+			BinaryUtility::writeU64(out + 16, (unsigned long long)chunk.firstTick);
+			BinaryUtility::writeU64(out + 24, (unsigned long long)chunk.lastTick);
+			BinaryUtility::writeU32(out + 32, (unsigned int)chunk.minId);
+			BinaryUtility::writeU32(out + 36, (unsigned int)chunk.maxId);
+			BinaryUtility::writeU32(out + 40, chunk.entityCount);
+			BinaryUtility::writeU32(out + 44, chunk.sampleCount);
+			out += TrajectoryFormat::INDEX_ENTRY_SIZE;
+		}
+
+		BinaryUtility::writeU64(out, chunks.size());
+		BinaryUtility::writeU32(out + 8, TrajectoryFormat::INDEX_MAGIC);
+
+		file.write((const char*)index.data(), index.size());
+		file.flush();
+	}
+
+	void run()
+	{
+		Tracer::setThreadName("trajectory writer");
+
+		TrajectorySample sample;
+		long long chunkFirstTick = -1;
+
+		while (true)
+		{
+			if (!queue.pop(sample))
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+
+				idle.notify_all();
+				wakeUp.wait(lock, [this]() { return !queue.empty() || stopping.load(std::memory_order_acquire); });
+
+				if (queue.empty())
+					break;
+
+				continue;
+			}
+
+			if (chunkFirstTick < 0)
+				chunkFirstTick = sample.tick;
+
+			if (sample.tick >= chunkFirstTick + chunkTicks)
+			{
+				writeChunk();
+				chunkFirstTick = sample.tick;
+			}
+
+			pending.push_back(sample);
+		}
+
+		writeChunk();
+		writeIndex();
+	}
+
+public:
+	TrajectoryRecorder(std::string path, long long chunkTicks = 64, size_t queueCapacity = 1 << 20)
+		: queue(queueCapacity), stopping(false), stallCount(0), chunkTicks(chunkTicks), written(0)
+	{
+		file.open(path, std::ios::binary | std::ios::trunc);
+
+		unsigned char header[TrajectoryFormat::HEADER_SIZE];
+		BinaryUtility::writeU32(header, TrajectoryFormat::MAGIC);
+		BinaryUtility::writeU32(header + 4, TrajectoryFormat::VERSION);
+
+		file.write((const char*)header, sizeof(header));
+		written = sizeof(header);
+
+		writer = std::thread(&TrajectoryRecorder::run, this);
+	}
+
+	~TrajectoryRecorder()
+	{
+		close();
+	}
+
+	bool isOpen() { return file.is_open(); }
+	long long getStallCount() { return stallCount; }
+
+	void attach(Model* model)
+	{
+		model->addTickListener([this](Model* m)
+			{
+				this->record(m);
+			}
+		);
+	}
+
+	void record(Model* model)
+	{
+		TrajectorySample sample;
+		sample.tick = model->getTick();
+
+		for (Entity* entity : model->getEntities())
+		{
+			if (!entity->isAnimal())
+				continue;
+
+			sample.id = entity->getId();
+			sample.xPos = (unsigned short)entity->getPosition().getX();
+			sample.yPos = (unsigned short)entity->getPosition().getY();
+			sample.health = (unsigned short)entity->getHealth();
+			sample.hunger = (unsigned short)entity->getHunger();
+			sample.state = (unsigned char)entity->getState();
+
+			if (!queue.push(sample))
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				stallCount++;
+
+				wakeUp.notify_one();
+				idle.wait(lock, [this]() { return queue.size() < queue.capacity(); });
+
+				queue.push(sample);
+			}
+		}
+
+		// One wakeup per tick's batch
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+		}
+
+		wakeUp.notify_one();
+	}
+
+	void close()
+	{
+		if (!writer.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping.store(true, std::memory_order_release);
+		}
+
+		wakeUp.notify_one();
+		writer.join();
+
+		file.close();
+	}
+};
+
+class TrajectoryReader
+{
+	std::ifstream file;
+	std::vector<TrajectoryFormat::Chunk> chunks;
+	std::vector<unsigned char> payload;
+
+	struct Columns
+	{
+		std::vector<int> ids;
+		std::vector<size_t> counts;
+		const unsigned char* begin[7];
+		const unsigned char* end[7];
+	};
+
+	bool readChunk(TrajectoryFormat::Chunk& chunk, Columns& columns)
+	{
+		payload.resize((size_t)chunk.size);
+
+		file.clear();
+		file.seekg((std::streamoff)chunk.offset);
+		file.read((char*)payload.data(), payload.size());
+
+		if (!file)
+			return false;
+
+		const unsigned char* in = payload.data();
+		const unsigned char* end = in + payload.size();
+
+		size_t entityCount = (size_t)BinaryUtility::readVarint(in, end);
+
+		const unsigned char* columnBegin[9];
+		const unsigned char* columnEnd[9];
+
+		for (int i = 0; i < 9; i++)
+		{
+			size_t size = (size_t)BinaryUtility::readVarint(in, end);
+
+			if (size > (size_t)(end - in))
+				return false;
+
+			columnBegin[i] = in;
+			columnEnd[i] = in + size;
+			in += size;
+		}
+
+		columns.ids.resize(entityCount);
+		columns.counts.resize(entityCount);
+
+		int id = 0;
+		for (size_t i = 0; i < entityCount; i++)
+		{
+			id += (int)BinaryUtility::readVarint(columnBegin[0], columnEnd[0]);
+			columns.ids[i] = id;
+			columns.counts[i] = (size_t)BinaryUtility::readVarint(columnBegin[1], columnEnd[1]);
+		}
+
+		for (int i = 0; i < 7; i++)
+		{
+			columns.begin[i] = columnBegin[i + 2];
+			columns.end[i] = columnEnd[i + 2];
+		}
+
+		return true;
+	}
+
+	template<typename Callback>
+	void decode(TrajectoryFormat::Chunk& chunk, Columns& columns, int onlyId, long long fromTick, long long toTick, Callback callback)
+	{
+		size_t sampleIndex = 0;
+
+		for (size_t entity = 0; entity < columns.ids.size(); entity++)
+		{
+			TrajectorySample sample;
+			sample.id = columns.ids[entity];
+			sample.tick = chunk.firstTick;
+
+			long long x = 0;
+			long long y = 0;
+			long long health = 0;
+			long long hunger = 0;
+
+			for (size_t i = 0; i < columns.counts[entity]; i++, sampleIndex++)
+			{
+				sample.tick += (long long)BinaryUtility::readVarint(columns.begin[0], columns.end[0]);
+				x += BinaryUtility::unzigzag(BinaryUtility::readVarint(columns.begin[1], columns.end[1]));
+				y += BinaryUtility::unzigzag(BinaryUtility::readVarint(columns.begin[2], columns.end[2]));
+				health += BinaryUtility::unzigzag(BinaryUtility::readVarint(columns.begin[3], columns.end[3]));
+				hunger += BinaryUtility::unzigzag(BinaryUtility::readVarint(columns.begin[4], columns.end[4]));
+
+				if ((onlyId >= 0 && sample.id != onlyId) || sample.tick < fromTick || sample.tick > toTick)
+					continue;
+
+				sample.xPos = (unsigned short)x;
+				sample.yPos = (unsigned short)y;
+				sample.health = (unsigned short)health;
+				sample.hunger = (unsigned short)hunger;
+
+				const unsigned char* packed = columns.begin[5] + sampleIndex / 2;
+				sample.state = packed < columns.end[5] ? (*packed >> (sampleIndex % 2 * 4)) & 0x0F : 0;
+
+				callback(sample);
+			}
+
+			if (onlyId >= 0 && sample.id >= onlyId)
+				break;
+		}
+	}
+
+public:
+	TrajectoryReader() {}
+
+	TrajectoryReader(std::string path)
+	{
+		open(path);
+	}
+
+	bool open(std::string path)
+	{
+		chunks.clear();
+		file.open(path, std::ios::binary | std::ios::ate);
+
+		if (!file)
+			return false;
+
+		long long size = (long long)file.tellg();
+
+		if (size < TrajectoryFormat::HEADER_SIZE + TrajectoryFormat::TRAILER_SIZE)
+			return false;
+
+		unsigned char trailer[TrajectoryFormat::TRAILER_SIZE];
+		file.seekg(size - TrajectoryFormat::TRAILER_SIZE);
+		file.read((char*)trailer, sizeof(trailer));
+
+		if (!file || BinaryUtility::readU32(trailer + 8) != TrajectoryFormat::INDEX_MAGIC)
+			return false;
+
+		unsigned long long count = BinaryUtility::readU64(trailer);
+
+		if (count > (unsigned long long)size / TrajectoryFormat::INDEX_ENTRY_SIZE)
+			return false;
+
+		std::vector<unsigned char> index((size_t)count * TrajectoryFormat::INDEX_ENTRY_SIZE);
+		file.seekg(size - TrajectoryFormat::TRAILER_SIZE - (long long)index.size());
+		file.read((char*)index.data(), index.size());
+
+		if (!file)
+			return false;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const unsigned char* in = index.data() + i * TrajectoryFormat::INDEX_ENTRY_SIZE;
+			TrajectoryFormat::Chunk chunk;
+
+			chunk.offset = BinaryUtility::readU64(in);
+			chunk.size = BinaryUtility::readU64(in + 8);
+			chunk.firstTick = (long long)BinaryUtility::readU64(in + 16);
+			chunk.lastTick = (long long)BinaryUtility::readU64(in + 24);
+			chunk.minId = (int)BinaryUtility::readU32(in + 32);
+			chunk.maxId = (int)BinaryUtility::readU32(in + 36);
+			chunk.entityCount = BinaryUtility::readU32(in + 40);
+			chunk.sampleCount = BinaryUtility::readU32(in + 44);
+
+			chunks.push_back(chunk);
+		}
+
+		return true;
+	}
+
+	size_t getChunkCount() { return chunks.size(); }
+
+	template<typename Callback>
+	void forEntity(int id, Callback callback)
+	{
+		Columns columns;
+
+		for (TrajectoryFormat::Chunk& chunk : chunks)
+		{
+			if (id < chunk.minId || id > chunk.maxId)
+				continue;
+
+			if (!readChunk(chunk, columns) || !std::binary_search(columns.ids.begin(), columns.ids.end(), id))
+				continue;
+
+			decode(chunk, columns, id, chunk.firstTick, chunk.lastTick, callback);
+		}
+	}
+
+	template<typename Callback>
+	void forWindow(long long fromTick, long long toTick, Callback callback)
+	{
+		Columns columns;
+
+		for (TrajectoryFormat::Chunk& chunk : chunks)
+		{
+			if (chunk.lastTick < fromTick || chunk.firstTick > toTick)
+				continue;
+
+			if (readChunk(chunk, columns))
+				decode(chunk, columns, -1, fromTick, toTick, callback);
+		}
+	}
+};
@@ -4,8 +4,17 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "Terminal.h"
+#include "WorldSnapshot.h"
 #include "ViewState.h"
 #include "Model.h"
+#include "PerfCounters.h"
 #include "Entity.h"
 
 class View
@@ -18,6 +27,10 @@ protected:
 	static const int consoleWidth = 80;
 	static const int consoleHeight = 80;
 
+	static const int MAP_RESERVED_ROWS = 4;
+	static const int INFO_RESERVED_ROWS = 4;
+	static const int DEFAULT_SCREEN_ROWS = 24;
+
 	bool toPlayIsChosen;
 	bool toContinueIsChosen;
 	bool toExitIsChosen;
@@ -71,24 +84,24 @@ protected:
 			callbacks[optionNumber - 1] = new std::function<void()>(callbackFunction);
 		}
 
-		void drawMenu()
+		int getHeight()
 		{
-			for (int i = 0; i < 10; i++)
-				std::cout << "\n";
+			return 10 + (int)options.size();
+		}
 
+		void drawMenu(Terminal& terminal)
+		{
 			for (int i = 0; i < options.size(); i++)
 			{
 				std::string option = options[i];
-				int offset = 0;
 
 				if (i == currentOption - 1)
-				{
-					offset = 2;
 					option = std::string("* ") + option;
-				}
 
-				std::cout << marginLeft(option, getMarginAmountToCenter(option)) << "\n";
+				terminal.write(10 + i, getMarginAmountToCenter(option), option);
 			}
+
+			terminal.setCursor(10 + (int)options.size(), 0);
 		}
 
 		void makeSelection()
@@ -101,9 +114,199 @@ protected:
 	Menu startMenu;
 	Menu continueMenu;
 
+	Terminal terminal;
+
+	std::mutex mutex;
+	std::shared_ptr<const WorldSnapshot> snapshot;
+	std::atomic<bool> snapshotIsConsumed;
+	bool consoleIsDrawn;
+	std::vector<std::string> consoleMessages;
+	ViewState lastRenderedState;
+
+	std::mutex requestMutex;
+	Viewport viewport;
+	EntityQuery infoQuery;
+	int infoMatchedCount;
+	int worldHeight;
+	int worldWidth;
+	std::atomic<long long> requestVersion;
+	std::atomic<bool> recordsAreNeeded;
+	bool densityIsShown;
+
+	PerfCounters* perf;
+	std::atomic<bool> perfIsShown;
+
+	static int getLabelWidth(int height)
+	{
+		int digits = 1;
+
+		for (int value = height; value >= 10; value /= 10)
+			digits++;
+
+		return std::max(3, digits + 1);
+	}
+
+	static char getKindSymbol(int kind)
+	{
+		switch (kind)
+		{
+		case BlockCounts::PLANT_EATING:
+			return '@';
+
+		case BlockCounts::PREDATOR:
+			return '&';
+
+		case BlockCounts::PLANT:
+			return 'X';
+		}
+
+		return '*';
+	}
+
+	static char getDensityShade(int total, int blockSize)
+	{
+		static const char shades[] = "-.:=+#%@";
+		static const int shadeCount = sizeof(shades) - 1;
+
+		if (total <= 0)
+			return shades[0];
+
+		int shade = 1 + (int)((long long)total * (shadeCount - 1) / ((long long)blockSize * blockSize));
+
+		return shades[std::min(shade, shadeCount - 1)];
+	}
+
+	char getBlockGlyph(const int* counts, int blockSize)
+	{
+		int total = 0;
+		int dominant = 0;
+
+		for (int kind = 0; kind < BlockCounts::KIND_COUNT; kind++)
+		{
+			total += counts[kind];
+
+			if (counts[kind] > counts[dominant])
+				dominant = kind;
+		}
+
+		if (blockSize > 1 && densityIsShown)
+			return getDensityShade(total, blockSize);
+
+		return total > 0 ? getKindSymbol(dominant) : '-';
+	}
+
+	void fitViewport(const WorldSnapshot& world)
+	{
+		int screenRows = DEFAULT_SCREEN_ROWS;
+		int screenColumns = consoleWidth;
+
+		Terminal::querySize(screenRows, screenColumns);
+
+		std::lock_guard<std::mutex> lock(requestMutex);
+
+		Viewport fitted = viewport;
+		fitted.rows = std::max(1, screenRows - MAP_RESERVED_ROWS - getPerfRows());
+		fitted.columns = std::max(1, (screenColumns - getLabelWidth(world.height)) / 3);
+
+		worldHeight = world.height;
+		worldWidth = world.width;
+		fitted.clamp(worldHeight, worldWidth);
+
+		if (fitted != viewport)
+		{
+			viewport = fitted;
+			requestVersion++;
+		}
+	}
+
+	void fitInfoPage(const WorldSnapshot& world)
+	{
+		int screenRows = DEFAULT_SCREEN_ROWS;
+		int screenColumns = consoleWidth;
+
+		Terminal::querySize(screenRows, screenColumns);
+
+		std::lock_guard<std::mutex> lock(requestMutex);
+
+		infoMatchedCount = world.matchedCount;
+
+		int limit = std::max(1, screenRows - INFO_RESERVED_ROWS);
+
+		if (limit != infoQuery.limit)
+		{
+			infoQuery.limit = limit;
+			infoQuery.offset = infoQuery.offset / limit * limit;
+			requestVersion++;
+		}
+	}
+
+	void changeInfoQuery(std::function<void(EntityQuery&)> change)
+	{
+		std::lock_guard<std::mutex> lock(requestMutex);
+
+		change(infoQuery);
+		requestVersion++;
+	}
+
+	void turnInfoPage(int pages)
+	{
+		changeInfoQuery([this, pages](EntityQuery& query)
+			{
+				int offset = query.offset + pages * query.limit;
+
+				if (offset >= 0 && offset < infoMatchedCount)
+					query.offset = offset;
+			}
+		);
+	}
+
+	void filterInfo(std::function<void(EntityQuery&)> change)
+	{
+		changeInfoQuery([change](EntityQuery& query)
+			{
+				change(query);
+				query.offset = 0;
+			}
+		);
+	}
+
+	void pan(int columns, int rows)
+	{
+		std::lock_guard<std::mutex> lock(requestMutex);
+
+		viewport.left += columns * std::max(1, viewport.columns / 4);
+		viewport.bottom += rows * std::max(1, viewport.rows / 4);
+		viewport.clamp(worldHeight, worldWidth);
+
+		requestVersion++;
+	}
+
+	void zoom(int delta)
+	{
+		std::lock_guard<std::mutex> lock(requestMutex);
+
+		int centerX = (viewport.left + viewport.columns / 2) << viewport.zoom;
+		int centerY = (viewport.bottom + viewport.rows / 2) << viewport.zoom;
+
+		viewport.zoom = std::max(0, std::min(viewport.zoom + delta, Viewport::getMaxZoom(worldHeight, worldWidth)));
+		viewport.left = (centerX >> viewport.zoom) - viewport.columns / 2;
+		viewport.bottom = (centerY >> viewport.zoom) - viewport.rows / 2;
+		viewport.clamp(worldHeight, worldWidth);
+
+		requestVersion++;
+	}
+
 public:
-	View(Model* model) : state(STARTMENU), previousState(STARTMENU), model(model)
+	View(Model* model) : state(STARTMENU), previousState(STARTMENU), model(model), snapshotIsConsumed(true), consoleIsDrawn(false), lastRenderedState(STARTMENU), infoMatchedCount(0),
+		requestVersion(0), recordsAreNeeded(false), densityIsShown(false), perf(nullptr), perfIsShown(false)
 	{
+		worldHeight = model->getMap()->getHeight();
+		worldWidth = model->getMap()->getWidth();
+
+		viewport.rows = DEFAULT_SCREEN_ROWS - MAP_RESERVED_ROWS;
+		viewport.columns = (consoleWidth - getLabelWidth(worldHeight)) / 3;
+		viewport.clamp(worldHeight, worldWidth);
+
 		toPlayIsChosen = false;
 		toContinueIsChosen = false;
 		toExitIsChosen = false;
@@ -194,92 +397,180 @@ public:
 		return (consoleWidth - str.size()) / 2;
 	}
 
-	void drawMap()
+	int getPerfRows()
+	{
+		return perf && perfIsShown ? 1 : 0;
+	}
+
+	int getMapRows(const WorldSnapshot& world)
+	{
+		return world.viewport.rows + 2 + getPerfRows();
+	}
+
+	int getMapColumns(const WorldSnapshot& world)
+	{
+		return getLabelWidth(world.height) + 3 * world.viewport.columns;
+	}
+
+	int drawMap(const WorldSnapshot& world, int top = 0)
 	{
-		std::vector<std::vector<std::string>> map;
+		const Viewport& camera = world.viewport;
+
+		int blockSize = camera.getBlockSize();
+		int labelWidth = getLabelWidth(world.height);
+
+		char label[96];
 
-		for (int i = 0; i < model->getMap()->getHeight(); i++)
+		for (int i = 0; i < camera.rows; i++)
 		{
-			std::vector<std::string> row;
-			for (int j = 0; j < model->getMap()->getWidth(); j++)
-				row.push_back(std::string("-"));
+			int row = top + camera.rows - 1 - i;
 
-			map.push_back(row);
+			std::snprintf(label, sizeof(label), "%d", (camera.bottom + i) * blockSize + 1);
+			terminal.write(row, 0, label);
+
+			for (int j = 0; j < camera.columns; j++)
+				terminal.put(row, labelWidth + 3 * j, getBlockGlyph(world.getBlock(i, j), blockSize));
 		}
 
-		for (Entity* entity : model->getEntities())
+		int labelsRow = top + camera.rows;
+		int nextFreeColumn = 0;
+
+		for (int j = 0; j < camera.columns; j++)
 		{
-			int rowCoordinate = entity->getPosition().getY();
-			int colCoordinate = entity->getPosition().getX();
+			int column = labelWidth + 3 * j;
+
+			if (column < nextFreeColumn)
+				continue;
 
-			std::string symbol = entity->getSymbolNotation();
+			int length = std::snprintf(label, sizeof(label), "%d", (camera.left + j) * blockSize + 1);
+			terminal.write(labelsRow, column, label, length);
 
-			map[rowCoordinate - 1][colCoordinate - 1] = symbol;
+			nextFreeColumn = column + length + 1;
 		}
 
-		for (int i = model->getMap()->getHeight() - 1; i >= 0; i --)
-		{
-			if (i + 1 < 10)
-				std::cout << (i + 1) << "  ";
+		int length = std::snprintf(label, sizeof(label), "tick %lld  %s  x %d-%d  y %d-%d  1:%d %s",
+			world.tick, world.status.c_str(),
+			camera.left * blockSize + 1, std::min(world.width, (camera.left + camera.columns) * blockSize),
+			camera.bottom * blockSize + 1, std::min(world.height, (camera.bottom + camera.rows) * blockSize),
+			blockSize, blockSize > 1 && densityIsShown ? "density" : "dominant");
+		terminal.write(labelsRow + 1, 0, label, length);
+
+		int row = labelsRow + 2;
 
-			else
-				std::cout << (i + 1) << " ";
+		// Reads only the published counters, so the overlay never waits on a tick
+		if (getPerfRows())
+			terminal.write(row++, 0, perf->getStatusLine());
 
-			for (int j = 0; j < model->getMap()->getWidth(); j++)
-				std::cout << map[i][j] << "  ";
+		terminal.setCursor(row, 0);
 
-			std::cout << "\n";
+		return row;
+	}
+
+	int drawMapWithHint(const WorldSnapshot& world)
+	{
+		int row = drawMap(world);
+
+		const char* hint = "[wasd pan  +- zoom  m shade  p play  f fast  . step  ; console]";
+
+		terminal.write(row, 0, hint);
+		terminal.setCursor(row, (int)std::strlen(hint));
+
+		return row + 1;
+	}
+
+	int drawInfo(const WorldSnapshot& world, int top = 0)
+	{
+		char line[160];
+
+		int length = std::snprintf(line, sizeof(line), "%10s%5s%8s%8s%14s%8s%16s%5s%5s",
+			"ID", "OLD", "HEALTH", "HUNGER", "TYPE", "SEX", "STATE", "XPOS", "YPOS");
+		terminal.write(top, 0, line, length);
+
+		int row = top + 1;
+
+		for (const EntityRecord& record : world.records)
+		{
+			length = std::snprintf(line, sizeof(line), "%10d%5d%8d%8d%14s%8s%16s%5d%5d",
+				record.id, record.old, record.health, record.hunger, record.getTypeName(),
+				record.getSexNotation(), EntityQuery::getStateName(record.state), record.xPos, record.yPos);
+
+			terminal.write(row++, 0, line, length);
 		}
 
-		std::cout << "   ";
-		for (int j = 0; j < model->getMap()->getWidth(); j++)
-			if (j + 1 < 10)
-				std::cout << (j + 1) << "  ";
+		const EntityQuery& query = world.query;
 
-			else
-				std::cout << (j + 1) << " ";
+		char region[48] = "all";
 
-		std::cout << "\n";
+		if (query.hasRegion)
+			std::snprintf(region, sizeof(region), "x %d-%d y %d-%d", query.left, query.right, query.bottom, query.top);
+
+		int first = world.records.empty() ? 0 : query.offset + 1;
+
+		length = std::snprintf(line, sizeof(line), "%d-%d of %d  sort %s %s",
+			first, query.offset + (int)world.records.size(), world.matchedCount,
+			EntityQuery::getSortColumnName(query.sortColumn), query.descending ? "desc" : "asc");
+		terminal.write(row, 0, line, length);
+
+		length = std::snprintf(line, sizeof(line), "kind %s  state %s  region %s",
+			EntityQuery::getKindName(query.kind), EntityQuery::getStateName(query.state), region);
+		terminal.write(row + 1, 0, line, length);
+
+		const char* hint = "[ws page  ad sort  r reverse  k kind  e state  v region]";
+
+		terminal.write(row + 2, 0, hint);
+		terminal.setCursor(row + 2, (int)std::strlen(hint));
+
+		return row + 3;
 	}
 
-	void drawInfo()
+	// At least one row is kept for messages so the prompt does not jump when they clear
+	int getConsoleMessageRows()
 	{
-		std::cout << std::setw(10) << "ID"
-			<< std::setw(5) << "OLD"
-			<< std::setw(8) << "HEALTH"
-			<< std::setw(8) << "HUNGER"
-			<< std::setw(20) << "TYPE"
-			<< std::setw(8) << "SEX"
-			<< std::setw(5) << "XPOS"
-			<< std::setw(5) << "YPOS" << "\n";
-		
-		for (Entity* entity : model->getEntities())
-			std::cout << std::setw(10) << entity->getId()
-			<< std::setw(5) << entity->getOld()
-			<< std::setw(8) << entity->getHealth()
-			<< std::setw(8) << entity->getHunger()
-			<< std::setw(20) << entity->typeName()
-			<< std::setw(8) << entity->getSexNotation()
-			<< std::setw(5) << entity->getPosition().getX()
-			<< std::setw(5) << entity->getPosition().getY() << "\n";
+		return std::max(1, (int)consoleMessages.size());
 	}
 
-	void drawMapWithConsole()
+	int drawMapWithConsole(const WorldSnapshot& world)
 	{
-		drawMap();
+		int row = drawMap(world);
+
+		for (int i = 0; i < (int)consoleMessages.size(); i++)
+			terminal.write(row + i, 0, consoleMessages[i]);
+
+		row += getConsoleMessageRows();
+		terminal.put(row, 0, ':');
+		terminal.setCursor(row, 1);
 
-		std::cout << "\n\n:";
+		return row + 1;
 	}
 
-	void drawMapWithPlayerWithConsole()
+	int drawMapWithPlayerWithConsole(const WorldSnapshot& world)
 	{
-		drawInfo();
+		int row = drawInfo(world) + 2;
 
-		std::cout << "\n\n:";
+		terminal.put(row, 0, ':');
+		terminal.setCursor(row, 1);
+
+		return row + 1;
+	}
+
+	void prepareScreen(int rows, int columns)
+	{
+		if (columns < consoleWidth)
+			columns = consoleWidth;
+
+		terminal.resize(columns, rows);
+		terminal.clear();
+
+		if (state == CONSOLE || lastRenderedState == CONSOLE)
+			terminal.invalidate();
+
+		lastRenderedState = state;
 	}
 
 	void nextState()
 	{
+		std::lock_guard<std::mutex> lock(mutex);
+
 		ViewState state = getState();
 
 		if (state == STARTMENU)
@@ -291,7 +582,7 @@ public:
 				state = OBSERVATION;
 
 			else if (toExitIsChosen)
-				exit(0);
+				state = EXIT;
 		}
 
 		else if (state == OBSERVATION)
@@ -312,7 +603,7 @@ public:
 				state = OBSERVATION;
 
 			else if (toExitIsChosen)
-				std::exit(0);
+				state = EXIT;
 		}
 
 		else if (state == CONSOLE)
@@ -333,6 +624,9 @@ public:
 				state = CONSOLE;
 		}
 
+		if (KeyboardUtility::isInputClosed())
+			state = EXIT;
+
 		if (state == STARTMENU)
 		{
 			if (KeyboardUtility::onS())
@@ -351,27 +645,171 @@ public:
 				continueMenu.selectAbove();
 		}
 
+		else if (state == INFO && getState() == INFO)
+		{
+			if (KeyboardUtility::onW())
+				turnInfoPage(-1);
+
+			else if (KeyboardUtility::onS())
+				turnInfoPage(1);
+
+			else if (KeyboardUtility::onA() || KeyboardUtility::onD())
+			{
+				int step = KeyboardUtility::onD() ? 1 : EntityQuery::SORT_COLUMN_COUNT - 1;
+
+				filterInfo([step](EntityQuery& query) { query.sortColumn = (query.sortColumn + step) % EntityQuery::SORT_COLUMN_COUNT; });
+			}
+
+			else if (KeyboardUtility::onR())
+				filterInfo([](EntityQuery& query) { query.descending = !query.descending; });
+
+			else if (KeyboardUtility::onK())
+				filterInfo([](EntityQuery& query) { query.kind = query.kind + 1 < BlockCounts::KIND_COUNT ? query.kind + 1 : EntityQuery::ANY; });
+
+			else if (KeyboardUtility::onE())
+				filterInfo([](EntityQuery& query) { query.state = query.state + 1 < EntityQuery::STATE_COUNT ? query.state + 1 : EntityQuery::ANY; });
+
+			else if (KeyboardUtility::onV())
+				filterInfo([this](EntityQuery& query)
+					{
+						int blockSize = viewport.getBlockSize();
+
+						query.hasRegion = !query.hasRegion;
+						query.left = viewport.left * blockSize + 1;
+						query.bottom = viewport.bottom * blockSize + 1;
+						query.right = (viewport.left + viewport.columns) * blockSize;
+						query.top = (viewport.bottom + viewport.rows) * blockSize;
+					}
+				);
+		}
+
+		else if (state == OBSERVATION)
+		{
+			if (KeyboardUtility::onW())
+				pan(0, 1);
+
+			else if (KeyboardUtility::onS())
+				pan(0, -1);
+
+			else if (KeyboardUtility::onA())
+				pan(-1, 0);
+
+			else if (KeyboardUtility::onD())
+				pan(1, 0);
+
+			else if (KeyboardUtility::onPlus())
+				zoom(-1);
+
+			else if (KeyboardUtility::onMinus())
+				zoom(1);
+
+			else if (KeyboardUtility::onM())
+				densityIsShown = !densityIsShown;
+		}
+
+		if (recordsAreNeeded != (state == INFO))
+		{
+			recordsAreNeeded = state == INFO;
+			requestVersion++;
+		}
+
 		resetEvents();
 		setState(state);
 	}
 
+	void publish(std::shared_ptr<const WorldSnapshot> next)
+	{
+		std::atomic_store(&snapshot, next);
+		snapshotIsConsumed = false;
+	}
+
+	bool isSnapshotConsumed() { return snapshotIsConsumed; }
+
+	Viewport getViewport()
+	{
+		std::lock_guard<std::mutex> lock(requestMutex);
+		return viewport;
+	}
+
+	long long getRequestVersion() { return requestVersion; }
+
+	bool areRecordsNeeded() { return recordsAreNeeded; }
+
+	EntityQuery getInfoQuery()
+	{
+		std::lock_guard<std::mutex> lock(requestMutex);
+		return infoQuery;
+	}
+
+	void redrawConsole()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		consoleIsDrawn = false;
+	}
+
+	void setPerfCounters(PerfCounters* counters) { perf = counters; }
+	void setPerfShown(bool isShown) { perfIsShown = isShown; }
+
+	void setConsoleMessages(const std::vector<std::string>& messages)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		consoleMessages = messages;
+	}
+
 	void render()
 	{
-		system("cls");
+		std::lock_guard<std::mutex> lock(mutex);
+
+		std::shared_ptr<const WorldSnapshot> world = std::atomic_load(&snapshot);
+		snapshotIsConsumed = true;
+
+		if (state != CONSOLE)
+			consoleIsDrawn = false;
 
 		if (state == STARTMENU)
-			startMenu.drawMenu();
+		{
+			prepareScreen(startMenu.getHeight() + 1, consoleWidth);
+			startMenu.drawMenu(terminal);
+		}
+
+		else if (state == CONTINUEMENU)
+		{
+			prepareScreen(continueMenu.getHeight() + 1, consoleWidth);
+			continueMenu.drawMenu(terminal);
+		}
+
+		else if (!world || state == EXIT)
+			return;
 
 		else if (state == OBSERVATION)
-			drawMap();
+		{
+			fitViewport(*world);
+
+			prepareScreen(getMapRows(*world) + 1, getMapColumns(*world));
+			drawMapWithHint(*world);
+		}
 
 		else if (state == INFO)
-			drawInfo();
+		{
+			fitInfoPage(*world);
+
+			prepareScreen((int)world->records.size() + INFO_RESERVED_ROWS, consoleWidth);
+			drawInfo(*world);
+		}
 
 		else if (state == CONSOLE)
-			drawMapWithConsole();
+		{
+			if (consoleIsDrawn)
+				return;
 
-		else if (state == CONTINUEMENU)
-			continueMenu.drawMenu();
+			fitViewport(*world);
+
+			prepareScreen(getMapRows(*world) + getConsoleMessageRows() + 1, getMapColumns(*world));
+			drawMapWithConsole(*world);
+
+			consoleIsDrawn = true;
+		}
+
+		terminal.present();
 	}
 };
\ No newline at end of file
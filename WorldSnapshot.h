@@ -0,0 +1,104 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "EntityRecord.h"
+#include "BlockCounts.h"
+#include "EntityQuery.h"
+#include "Model.h"
+
+struct Viewport
+{
+	int left;
+	int bottom;
+	int rows;
+	int columns;
+	int zoom;
+
+	Viewport() : left(0), bottom(0), rows(0), columns(0), zoom(0) {}
+
+	int getBlockSize() const { return 1 << zoom; }
+
+	bool operator!=(const Viewport& other) const
+	{
+		return left != other.left || bottom != other.bottom || rows != other.rows || columns != other.columns || zoom != other.zoom;
+	}
+
+	static int getMaxZoom(int height, int width)
+	{
+		int zoom = 0;
+
+		while ((1 << zoom) < height || (1 << zoom) < width)
+			zoom++;
+
+		return zoom;
+	}
+
+	void clamp(int height, int width)
+	{
+		zoom = std::max(0, std::min(zoom, getMaxZoom(height, width)));
+
+		int blockRows = (height + getBlockSize() - 1) >> zoom;
+		int blockColumns = (width + getBlockSize() - 1) >> zoom;
+
+		left = std::max(0, std::min(left, blockColumns - columns));
+		bottom = std::max(0, std::min(bottom, blockRows - rows));
+	}
+};
+
+struct WorldSnapshot
+{
+	int height;
+	int width;
+	long long tick;
+	std::string status;
+
+	Viewport viewport;
+	std::vector<int> blocks;
+
+	EntityQuery query;
+	int matchedCount;
+	std::vector<EntityRecord> records;
+
+	const int* getBlock(int row, int column) const
+	{
+		return blocks.data() + ((size_t)row * viewport.columns + column) * BlockCounts::KIND_COUNT;
+	}
+
+	static std::shared_ptr<WorldSnapshot> capture(Model* model, Viewport viewport, const EntityQuery* query)
+	{
+		std::shared_ptr<WorldSnapshot> snapshot = std::make_shared<WorldSnapshot>();
+
+		snapshot->height = model->getMap()->getHeight();
+		snapshot->width = model->getMap()->getWidth();
+		snapshot->tick = model->getTick();
+		snapshot->matchedCount = 0;
+
+		BlockCounts* counts = model->getBlockCounts();
+
+		viewport.clamp(snapshot->height, snapshot->width);
+		viewport.rows = std::max(0, std::min(viewport.rows, counts->getRows(viewport.zoom) - viewport.bottom));
+		viewport.columns = std::max(0, std::min(viewport.columns, counts->getColumns(viewport.zoom) - viewport.left));
+
+		snapshot->viewport = viewport;
+		snapshot->blocks.resize((size_t)viewport.rows * viewport.columns * BlockCounts::KIND_COUNT);
+
+		int* out = snapshot->blocks.data();
+
+		for (int row = 0; row < viewport.rows; row++)
+			for (int column = 0; column < viewport.columns; column++)
+			{
+				const int* block = counts->getBlock(viewport.zoom, viewport.bottom + row, viewport.left + column);
+				out = std::copy(block, block + BlockCounts::KIND_COUNT, out);
+			}
+
+		if (query)
+		{
+			snapshot->query = *query;
+			snapshot->matchedCount = model->query(*query, snapshot->records);
+		}
+
+		return snapshot;
+	}
+};